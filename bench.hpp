@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+// collects frame counts, CPU time and latencies per benchmark phase
+// and writes them as JSON. The latency is taken from the first resize request
+// that is not applied yet to the commit of the new size. For the resize storm
+// these requests are injected by the script, only the maximise toggles go
+// through a configure of the compositor.
+
+static double cpu_time() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1e-6;
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct bench_phase {
+    std::string name;
+    unsigned long frames = 0;
+    unsigned long commits = 0;
+    double wall = 0;                // s
+    double cpu = 0;                 // s
+    std::vector<double> latencies;  // resize request to commit, ms
+};
+
+struct bench_recorder {
+    std::vector<bench_phase> phases;
+    bool active = false;
+    std::chrono::steady_clock::time_point phase_start;
+    double phase_cpu_start = 0;
+    unsigned long phase_commits_start = 0;
+
+    void begin(const std::string &name, unsigned long commits) {
+        phases.emplace_back();
+        phases.back().name = name;
+        phase_start = std::chrono::steady_clock::now();
+        phase_cpu_start = cpu_time();
+        phase_commits_start = commits;
+        active = true;
+    }
+
+    void end(unsigned long commits) {
+        if(!active) {
+            return;
+        }
+        bench_phase &p = phases.back();
+        p.wall = std::chrono::duration<double>(std::chrono::steady_clock::now()-phase_start).count();
+        p.cpu = cpu_time()-phase_cpu_start;
+        p.commits = commits-phase_commits_start;
+        active = false;
+    }
+
+    void frame() {
+        if(active) { phases.back().frames++; }
+    }
+
+    void latency(const std::chrono::steady_clock::time_point &since) {
+        if(active) {
+            phases.back().latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-since).count());
+        }
+    }
+
+    static double percentile(std::vector<double> values, const double p) {
+        if(values.empty()) {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        const size_t i = std::min(values.size()-1, size_t(p*(values.size()-1)+0.5));
+        return values[i];
+    }
+
+    void write_json(std::ostream &out) const {
+        out << "{\n  \"phases\": [";
+        for(size_t i = 0; i<phases.size(); i++) {
+            const bench_phase &p = phases[i];
+            out << (i ? "," : "") << "\n    {"
+                << "\"name\": \"" << p.name << "\", "
+                << "\"duration_s\": " << p.wall << ", "
+                << "\"frames\": " << p.frames << ", "
+                << "\"commits\": " << p.commits << ", "
+                << "\"fps\": " << (p.wall>0 ? p.frames/p.wall : 0) << ", "
+                << "\"cpu_percent\": " << (p.wall>0 ? 100*p.cpu/p.wall : 0) << ", "
+                << "\"cpu_ms_per_frame\": " << (p.frames ? 1000*p.cpu/p.frames : 0) << ", "
+                << "\"resize_to_commit_ms\": {"
+                << "\"count\": " << p.latencies.size() << ", "
+                << "\"p50\": " << percentile(p.latencies, 0.5) << ", "
+                << "\"p90\": " << percentile(p.latencies, 0.9) << ", "
+                << "\"p99\": " << percentile(p.latencies, 0.99) << ", "
+                << "\"max\": " << percentile(p.latencies, 1) << "}}";
+        }
+        out << "\n  ],\n  \"peak_rss_kb\": " << peak_rss_kb() << "\n}" << std::endl;
+    }
+};
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Runs the decorated window in benchmark mode against a headless weston
+# instance with software rendering and writes the JSON report.
+#
+# usage: run_bench.sh <client> <output.json> [client options]
+
+set -e
+
+CLIENT="$1"
+OUTPUT="$2"
+shift 2
+
+RUNTIME_DIR=$(mktemp -d)
+SOCKET=wayland-bench
+trap 'kill $WESTON_PID 2>/dev/null; rm -rf "$RUNTIME_DIR"' EXIT
+
+export XDG_RUNTIME_DIR="$RUNTIME_DIR"
+chmod 0700 "$RUNTIME_DIR"
+
+# pixman renderer, the client renders via llvmpipe into wl_shm buffers
+weston --backend=headless --renderer=pixman --socket=$SOCKET --idle-time=0 ${WESTON_ARGS} &
+WESTON_PID=$!
+
+# wait for the compositor socket
+for i in $(seq 1 50); do
+    [ -S "$RUNTIME_DIR/$SOCKET" ] && break
+    sleep 0.1
+done
+if [ ! -S "$RUNTIME_DIR/$SOCKET" ]; then
+    echo "weston did not start" >&2
+    exit 1
+fi
+
+WAYLAND_DISPLAY=$SOCKET LIBGL_ALWAYS_SOFTWARE=1 "$CLIENT" --bench --bench-output "$OUTPUT" "$@"
+cat "$OUTPUT"
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "bench.hpp"
+
+// presentation statistics from wp_presentation feedback: presented, discarded
+// and dropped frames and the latency from an input event until its result
+// reached the screen (input-to-photon)
+struct frame_stats {
+    unsigned long presented = 0;
+    unsigned long discarded = 0;        // replaced by a later commit before being shown
+    unsigned long dropped = 0;          // refresh cycles missed after the targeted one
+    std::vector<double> input_latencies;    // ms
+
+    // 'target_msc' is the first refresh the frame could have been shown at, 0 if unknown
+    void present(const uint64_t msc, const uint64_t target_msc, const double input_latency) {
+        presented++;
+        if(target_msc && msc>target_msc) {
+            dropped += msc-target_msc;
+        }
+        if(input_latency>=0) {
+            input_latencies.push_back(input_latency);
+        }
+    }
+
+    void discard() {
+        discarded++;
+    }
+
+    double input_latency(const double p) const {
+        return bench_recorder::percentile(input_latencies, p);
+    }
+
+    void write(std::ostream &out) const {
+        out << "presented: " << presented << ", discarded: " << discarded << ", dropped: " << dropped
+            << ", input-to-photon ms: p50 " << input_latency(0.5) << ", p90 " << input_latency(0.9)
+            << ", max " << input_latency(1) << " (" << input_latencies.size() << " inputs)" << std::endl;
+    }
+
+    void reset() {
+        *this = frame_stats();
+    }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <EGL/egl.h>
+
+// Move-only owners of Wayland and EGL objects. They convert to the raw handle,
+// so they are passed to the C API as they are, and assigning a new object
+// destroys the old one. Members of a struct are destroyed in reverse order of
+// their declaration, so a role object (xdg_surface, subsurface, viewport) and
+// a wl_egl_window are declared after their wl_surface, and an EGL surface after
+// its wl_egl_window.
+
+template<typename T, void (*destroy)(T *)>
+struct wl_handle {
+    T *ptr = nullptr;
+
+    wl_handle() = default;
+    wl_handle(const wl_handle &) = delete;
+    wl_handle &operator=(const wl_handle &) = delete;
+    wl_handle(wl_handle &&other) : ptr(other.release()) {}
+
+    wl_handle &operator=(wl_handle &&other) {
+        reset(other.release());
+        return *this;
+    }
+
+    wl_handle &operator=(T *p) {
+        reset(p);
+        return *this;
+    }
+
+    ~wl_handle() {
+        reset();
+    }
+
+    void reset(T *p = nullptr) {
+        if(ptr) { destroy(ptr); }
+        ptr = p;
+    }
+
+    // give up ownership, e.g. when the object was destroyed by its own event
+    T *release() {
+        T *p = ptr;
+        ptr = nullptr;
+        return p;
+    }
+
+    operator T *() const { return ptr; }
+};
+
+// EGLSurface and EGLContext, destroyed on the display they were created on
+template<typename T, EGLBoolean (*destroy)(EGLDisplay, T)>
+struct egl_handle {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    T handle = nullptr;
+
+    egl_handle() = default;
+    egl_handle(const egl_handle &) = delete;
+    egl_handle &operator=(const egl_handle &) = delete;
+    egl_handle(egl_handle &&other) : display(other.display), handle(other.handle) {
+        other.handle = nullptr;
+    }
+
+    egl_handle &operator=(egl_handle &&other) {
+        reset(other.display, other.handle);
+        other.handle = nullptr;
+        return *this;
+    }
+
+    ~egl_handle() {
+        reset();
+    }
+
+    void reset(EGLDisplay _display = EGL_NO_DISPLAY, T _handle = nullptr) {
+        if(handle) { destroy(display, handle); }
+        display = _display;
+        handle = _handle;
+    }
+
+    operator T() const { return handle; }
+};
+
+typedef egl_handle<EGLSurface, eglDestroySurface> egl_surface_handle;
+typedef egl_handle<EGLContext, eglDestroyContext> egl_context_handle;
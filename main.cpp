@@ -3,12 +3,40 @@
 #include <wayland-egl.h>
 #include <wayland-cursor.h>
 #include <wayland-xdg-shell-client-protocol.h>
+#include <wayland-viewporter-client-protocol.h>
+#include <wayland-xdg-decoration-unstable-v1-client-protocol.h>
+#include <wayland-presentation-time-client-protocol.h>
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+#include <wayland-single-pixel-buffer-v1-client-protocol.h>
+#endif
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/gl.h>
 #include <cstring>
+#include <dirent.h>
 #include <linux/input.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <vector>
 #include <map>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <thread>
+
+#include "bench.hpp"
+#include "frame_stats.hpp"
+#include "handles.hpp"
+#include "mock_compositor.hpp"
+#include "shm_pool.hpp"
+#include "spsc_queue.hpp"
+#include "theme.hpp"
+#include "title_text.hpp"
+#include "trace.hpp"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
@@ -18,446 +46,1964 @@ static struct wl_subcompositor *subcompositor = NULL;
 static struct xdg_wm_base *xdg_wm_base = NULL;
 static struct wl_seat *seat = NULL;
 static struct wl_shm *shm = NULL;
-static struct wl_cursor_theme *cursor_theme = NULL;
+static struct wp_viewporter *viewporter = NULL;
+static struct zxdg_decoration_manager_v1 *decoration_manager = NULL;
+static bool prefer_client_side = false;
+static struct wp_presentation *presentation = NULL;
+static clockid_t presentation_clock = CLOCK_MONOTONIC;
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+static struct wp_single_pixel_buffer_manager_v1 *single_pixel_buffer_manager = NULL;
+#endif
+static bool use_viewporter = true;
+static bool single_surface = false;
+static bool software_decorations = false;   // draw decorations on the CPU into wl_shm buffers
+static shm_pool decoration_pool;
+static const int frame_shadow = 10;         // drop shadow of the software drawn frame
+static theme active_theme;                  // default or loaded with --theme
+static layout_table decoration_layout;      // compiled from active_theme
 static struct wl_surface *cursor_surface = NULL;
 static EGLDisplay egl_display;
 static bool running = true;
 
+// currently bound EGL surface and context per thread, to skip redundant context switches
+static thread_local EGLSurface current_egl_surface = EGL_NO_SURFACE;
+static thread_local EGLContext current_egl_context = EGL_NO_CONTEXT;
+static bool skip_make_current = true;
+
+// damage tracking
+static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_buffers_with_damage = NULL;
+static bool full_redraw = false;        // ignore damage tracking, redraw everything
+static bool print_stats = false;
+static std::atomic<unsigned long> commit_count{0};     // from the main and the render thread
+
+// startup: time from process start to the first commit and to the first presented frame
+static const uint64_t process_start = trace_now();     // ns, CLOCK_MONOTONIC, at static initialisation
+static std::atomic<uint64_t> first_commit{0};         // from the main or the render thread
+static uint64_t first_presentation = 0;
+
+static void make_current(EGLSurface surface, EGLContext context, const char *element = nullptr) {
+    if(skip_make_current && surface==current_egl_surface && context==current_egl_context) {
+        return;
+    }
+    TRACE_SCOPE("eglMakeCurrent", element);
+    eglMakeCurrent(egl_display, surface, surface, context);
+    current_egl_surface = surface;
+    current_egl_context = context;
+}
+
+static EGLSurface create_egl_surface(EGLConfig config, EGLContext context, struct wl_egl_window *egl_window) {
+    EGLSurface surface = eglCreateWindowSurface(egl_display, config, egl_window, NULL);
+    // frame callbacks throttle the loop, do not block inside eglSwapBuffers
+    make_current(surface, context);
+    eglSwapInterval(egl_display, 0);
+    return surface;
+}
+
+static void commit(struct wl_surface *surface) {
+    wl_surface_commit(surface);
+    commit_count++;
+}
+
+// swap and report damage in surface coordinates with origin at the top left
+static void swap_buffers(EGLSurface surface, const int height, std::vector<EGLint> rects, const char *element) {
+    TRACE_SCOPE("eglSwapBuffers", element);
+    if(swap_buffers_with_damage && !rects.empty()) {
+        // EGL rectangles have their origin at the bottom left
+        for(size_t i = 0; i<rects.size(); i+=4) {
+            rects[i+1] = height-rects[i+1]-rects[i+3];
+        }
+        swap_buffers_with_damage(egl_display, surface, rects.data(), rects.size()/4);
+    }
+    else {
+        eglSwapBuffers(egl_display, surface);
+    }
+    commit_count++;
+}
+
+static void damage_buffer(struct wl_surface *surface, int32_t x, int32_t y, int32_t w, int32_t h) {
+    if(wl_surface_get_version(surface)>=WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION) {
+        wl_surface_damage_buffer(surface, x, y, w, h);
+    }
+    else {
+        wl_surface_damage(surface, 0, 0, INT32_MAX, INT32_MAX);
+    }
+}
+
+static struct wl_buffer *create_solid_buffer(double r, double g, double b, double a) {
+    // 1x1 buffer with premultiplied alpha, scaled by the viewport
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+    if(single_pixel_buffer_manager) {
+        return wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(single_pixel_buffer_manager,
+            uint32_t(r*a*UINT32_MAX), uint32_t(g*a*UINT32_MAX), uint32_t(b*a*UINT32_MAX), uint32_t(a*UINT32_MAX));
+    }
+#endif
+    const int fd = memfd_create("solid", MFD_CLOEXEC);
+    if(fd<0 || ftruncate(fd, sizeof(uint32_t))<0) {
+        std::cerr << "cannot create shm file" << std::endl;
+        return NULL;
+    }
+    const uint32_t pixel = (uint32_t(a*255)<<24) | (uint32_t(r*a*255)<<16) | (uint32_t(g*a*255)<<8) | uint32_t(b*a*255);
+    if(pwrite(fd, &pixel, sizeof(pixel), 0)!=sizeof(pixel)) {
+        std::cerr << "cannot write shm file" << std::endl;
+    }
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, sizeof(pixel));
+    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, 1, 1, sizeof(pixel), WL_SHM_FORMAT_ARGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return buffer;
+}
+
+// solid buffers can be attached to any number of surfaces, create one per colour
+static struct wl_buffer *get_solid_buffer(double r, double g, double b, double a) {
+    static std::map<uint32_t, struct wl_buffer *> solid_buffers;
+    const uint32_t key = (uint32_t(a*255)<<24) | (uint32_t(r*255)<<16) | (uint32_t(g*255)<<8) | uint32_t(b*255);
+    if(!solid_buffers.count(key)) {
+        solid_buffers[key] = create_solid_buffer(r, g, b, a);
+    }
+    return solid_buffers.at(key);
+}
+
 struct decoration;
 
 struct button;
 
+struct frame;
+
+struct window;
+
+struct output {
+    struct wl_output *output;
+    uint32_t name;              // registry name
+    int32_t scale = 1;
+};
+
+static std::vector<std::unique_ptr<output>> outputs;
+
+// stored as user data of every wl_surface of a window, maps input events
+// to the window and element without searching
+struct surface_owner {
+    struct window *window = NULL;
+    enum kind {
+        CONTENT, DECORATION, BUTTON, FRAME
+    } kind = CONTENT;
+};
+
+// all Wayland and EGL objects are owned by handles, declared in an order that
+// destroys every object before the one it was created from
 struct window {
-    EGLContext egl_context;
-    struct wl_surface *surface;
-    struct xdg_surface *xdg_surface;
-    struct xdg_toplevel *xdg_toplevel = NULL;
-    struct wl_egl_window *egl_window;
-    EGLSurface egl_surface;
+    egl_context_handle egl_context;
+    EGLConfig egl_config;
+    egl_context_handle content_context;     // for the content on the render thread
+    wl_handle<struct wl_surface, wl_surface_destroy> surface;
+    wl_handle<struct xdg_surface, xdg_surface_destroy> xdg_surface;
+    wl_handle<struct xdg_toplevel, xdg_toplevel_destroy> xdg_toplevel;
+    wl_handle<struct wl_egl_window, wl_egl_window_destroy> egl_window;
+    egl_surface_handle egl_surface;
 
     int width;
     int height;
     uint border_size;
     uint title_size;
-
-    bool maximised = false;
+    std::string title;
+
+    // toplevel states, as reported by the compositor
+    struct toplevel_state {
+        bool maximised = false;
+        bool activated = false;
+        bool resizing = false;
+        bool tiled = false;
+        bool suspended = false;             // not visible, since xdg_wm_base v6
+    };
+    toplevel_state state;
+    toplevel_state pending_state;           // applied with the next xdg_surface configure
+    bool maximised = false;                 // state.maximised, for the button appearance
+
+    std::vector<layout_rect> geometry;      // of all decoration elements, rows of decoration_layout
 
     std::vector<decoration> decorations;
 
     std::vector<button> buttons;
 
+    // single surface mode: all decoration elements in one subsurface
+    std::unique_ptr<frame> frame_surface;
+
+    // server side decorations, the decoration elements only exist in client side mode
+    wl_handle<struct zxdg_toplevel_decoration_v1, zxdg_toplevel_decoration_v1_destroy> toplevel_decoration;
+    bool server_side = false;
+    bool decoration_mode_pending = false;   // applied with the next xdg_surface configure
+    bool pending_server_side = false;
+
+    surface_owner content_owner;            // user data of the main surface
+    std::vector<const output*> outputs;     // outputs the main surface is shown on
+    bool closed = false;
+    bool shown = false;                     // the first frame was committed
+
     bool button_pressed = false;
-    wl_surface * current_surface = NULL;    // last entered surface
+    const surface_owner *current_owner = NULL;  // owner of the last entered surface
+    int current_region = -1;                // region of the frame under the pointer
 
     bool inhibit_motion = false;
+
+    // render scheduling: only redraw when 'dirty' and the compositor signalled the last frame
+    bool configured = false;
+    bool dirty = false;
+    wl_handle<struct wl_callback, wl_callback_destroy> frame_callback;
+    // render thread: a content commit was requested and its frame callback did not arrive yet
+    std::atomic<bool> content_pending{false};
+
+    // damage tracking: the content is only redrawn when its size changed
+    bool content_dirty = true;
+    int content_width = 0;
+    int content_height = 0;
+    int hovered_button = -1;                // button::type under the pointer
+
+    // coalesced configure, only the latest size is applied at the next frame
+    bool configure_pending = false;
+    uint32_t configure_serial = 0;
+    bool resize_pending = false;
+    int pending_width = 0;
+    int pending_height = 0;
+    bool pending_full = false;
+    std::chrono::steady_clock::time_point pending_since;   // first configure not applied yet
+    bool sync_decorations = false;          // decorations commit atomically with the main surface
+
+    // presentation feedback of the main surface
+    uint64_t input_time = 0;                // ns, first input event that is not shown yet
+    uint64_t last_presentation = 0;         // ns, in the presentation clock
+    uint32_t refresh = 0;                   // ns, 0 if unknown
+    uint64_t last_msc = 0;                  // refresh counter of the last presentation
+    double render_time = 0;                 // ns, smoothed duration of draw_window()
+    std::vector<std::unique_ptr<struct frame_feedback>> feedbacks;  // pending
 };
 
-struct button {
-    struct wl_surface *surface;
-    struct wl_subsurface *subsurface;
-    struct wl_egl_window *egl_window;
-    EGLSurface egl_surface;
-    EGLContext egl_context;
-    EGLDisplay egl_display;
+// solid coloured subsurface, either backed by an EGL window
+// or by a 1x1 buffer that is scaled by a viewport
+struct element : surface_owner {
+    wl_handle<struct wl_surface, wl_surface_destroy> surface;
+    wl_handle<struct wl_subsurface, wl_subsurface_destroy> subsurface;
+    wl_handle<struct wp_viewport, wp_viewport_destroy> viewport;
+    wl_handle<struct wl_egl_window, wl_egl_window_destroy> egl_window;
+    egl_surface_handle egl_surface;
+    EGLContext egl_context;     // shared with the window
+    struct wl_buffer *buffer = NULL;    // shared solid buffer, not owned
     double r, g, b, a;
+    int width = 0;
+    int height = 0;
+    bool dirty = true;          // needs to be drawn and committed
+    const char *name = "";      // for tracing
+    title_text text;            // only drawn on EGL and software surfaces, solid title bars have a label
+    int text_x = 0;
+    int text_y = 0;
+    bool software = false;      // drawn on the CPU into buffers of the decoration pool
+    shm_swapchain swapchain;
+
+    void init(wl_compositor* compositor, wl_subcompositor* subcompositor, wl_surface* source,
+              EGLConfig config, EGLContext context, int32_t w, int32_t h, bool solid = true, bool shm_only = false)
+    {
+        surface = wl_compositor_create_surface(compositor);
+        subsurface = wl_subcompositor_get_subsurface(subcompositor, surface, source);
+        wl_subsurface_set_desync(subsurface);
+        egl_context = context;
+        width = w;
+        height = h;
+        if(solid && use_viewporter) {
+            viewport = wp_viewporter_get_viewport(viewporter, surface);
+            wp_viewport_set_destination(viewport, w, h);
+            buffer = get_solid_buffer(r, g, b, a);
+        }
+        else if(software_decorations || shm_only) {
+            software = true;
+        }
+        else {
+            egl_window = wl_egl_window_create(surface, w, h);
+            egl_surface.reset(egl_display, create_egl_surface(config, egl_context, egl_window));
+        }
+    }
+
+    void set_size(const int w, const int h) {
+        if(w==width && h==height) {
+            return;
+        }
+        width = w;
+        height = h;
+        dirty = true;
+        if(viewport) {
+            // no reallocation, the compositor scales the single pixel
+            wp_viewport_set_destination(viewport, w, h);
+        }
+        else if(egl_window) {
+            wl_egl_window_resize(egl_window, w, h, 0, 0);
+        }
+    }
+
+    void set_color(double _r, double _g, double _b, double _a) {
+        if(_r==r && _g==g && _b==b && _a==a) {
+            return;
+        }
+        r=_r; g=_g; b=_b; a=_a;
+        dirty = true;
+        if(viewport) {
+            buffer = get_solid_buffer(r, g, b, a);
+        }
+    }
+
+    // returns true if the surface was committed
+    bool draw() {
+        if(!dirty && !full_redraw) {
+            return false;
+        }
+        dirty = false;
+        if(viewport) {
+            wl_surface_attach(surface, buffer, 0, 0);
+            damage_buffer(surface, 0, 0, 1, 1);
+            commit(surface);
+            return true;
+        }
+        if(software) {
+            bool valid;
+            shm_buffer *buf = swapchain.acquire(decoration_pool, width, height, valid);
+            if(!buf) {
+                return false;
+            }
+            const canvas c = buf->pixels();
+            fill_rect(c, 0, 0, width, height, premultiply(r, g, b, a));
+            text.draw(c, text_x, text_y);
+            swapchain.attach(surface, buf);
+            damage_buffer(surface, 0, 0, width, height);
+            commit(surface);
+            return true;
+        }
+        make_current(egl_surface, egl_context, name);
+        glClearColor(r, g, b, a);
+        {
+            TRACE_SCOPE("glClear", name);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        text.draw(egl_context, text_x, text_y, width, height);
+        swap_buffers(egl_surface, height, {0, 0, width, height}, name);
+        return true;
+    }
+
+    // the display list of the title lives in the window context, which outlives the element
+    void release_text() {
+        if(text.list && egl_surface) {
+            make_current(egl_surface, egl_context, name);
+            text.release();
+        }
+    }
+};
+
+// colour of a button for its interaction state, 'active' for toggled buttons
+static void button_color(const double base[4], bool hovered, bool pressed, bool active, double out[4]) {
+    static const double highlight[3] = {0.2, 0.4, 1.0};
+    const double mix = pressed ? 0.7 : (hovered ? 0.4 : 0);
+    for(int i = 0; i<3; i++) {
+        out[i] = (1-mix)*base[i] + mix*highlight[i];
+        if(active) { out[i] *= 0.5; }
+    }
+    out[3] = base[3];
+}
 
+struct button : element {
     enum type {
         CLOSE, MAXIMISE, MINIMISE
     } function;
 
+    double base[4];
+    int x = 0;
+    int y = 0;
+
     button(wl_compositor* compositor, wl_subcompositor* subcompositor, wl_surface* source,
-           EGLConfig config, int32_t x, int32_t y, type fnct, double _r, double _g, double _b, double _a)
+           EGLConfig config, EGLContext context, type fnct, double _r, double _g, double _b, double _a)
     {
         function = fnct;
+        static const char *names[] = {"close", "maximise", "minimise"};
+        name = names[fnct];
         r=_r; g=_g; b=_b; a=_a;
-        surface = wl_compositor_create_surface(compositor);
-        subsurface = wl_subcompositor_get_subsurface(subcompositor, surface, source);
-        wl_subsurface_set_desync(subsurface);
-        egl_display = eglGetDisplay(display);
-        egl_context = eglCreateContext (egl_display, config, EGL_NO_CONTEXT, NULL);
-        eglInitialize(egl_display, NULL, NULL);
+        base[0]=_r; base[1]=_g; base[2]=_b; base[3]=_a;
+        init(compositor, subcompositor, source, config, context, active_theme.button_width, active_theme.button_height);
         wl_subsurface_set_position(subsurface, x, y);
-        egl_window = wl_egl_window_create(surface, 10, 8);
-        egl_surface = eglCreateWindowSurface(egl_display, config, egl_window, NULL);
     }
 
-    void draw() const {
-        eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context);
-        glClearColor(r, g, b, a);
-        glClear(GL_COLOR_BUFFER_BIT);
-        eglSwapBuffers(egl_display, egl_surface);
+    // position relative to the title bar, buttons at its right end move with the width
+    void resize(const layout_rect &rect) {
+        if(rect.x!=x || rect.y!=y) {
+            x = rect.x;
+            y = rect.y;
+            wl_subsurface_set_position(subsurface, x, y);
+        }
+        set_size(rect.w, rect.h);
+    }
+
+    void set_state(bool hovered, bool pressed, bool active) {
+        double c[4];
+        button_color(base, hovered, pressed, active, c);
+        set_color(c[0], c[1], c[2], c[3]);
     }
 };
 
-struct decoration {
-    struct wl_surface *surface;
-    struct wl_subsurface *subsurface;
-    struct wl_egl_window *egl_window;
-    EGLSurface egl_surface;
-    EGLContext egl_context;
-    EGLDisplay egl_display;
-    double r, g, b, a;
+// decoration elements in drawing order, the title bar first
+static const enum xdg_toplevel_resize_edge decoration_edges[] = {
+    XDG_TOPLEVEL_RESIZE_EDGE_NONE,
+    XDG_TOPLEVEL_RESIZE_EDGE_LEFT, XDG_TOPLEVEL_RESIZE_EDGE_RIGHT, XDG_TOPLEVEL_RESIZE_EDGE_TOP, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM,
+    XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT, XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT,
+};
+
+struct decoration : element {
     uint border_size;
     uint title_bar_size;
 
     enum xdg_toplevel_resize_edge function;
 
+    // solid title bar: the text is drawn into a small subsurface on top of it,
+    // so that the title bar itself keeps its 1x1 buffer
+    std::unique_ptr<element> label;
+    int title_width = 0;
+
     decoration(wl_compositor* compositor, wl_subcompositor* subcompositor, wl_surface* source,
                const uint _border_size, const uint _title_bar_size,
-               EGLConfig config, enum xdg_toplevel_resize_edge type,
+               EGLConfig config, EGLContext context, enum xdg_toplevel_resize_edge type,
                double _r, double _g, double _b, double _a)
     {
         function = type;
+        static const char *names[] = {"title", "top", "bottom", "", "left", "top_left", "bottom_left", "", "right", "top_right", "bottom_right"};
+        name = names[type];
         r=_r; g=_g; b=_b; a=_a;
         border_size = _border_size;
         title_bar_size = _title_bar_size;
 
-        surface = wl_compositor_create_surface(compositor);
-        subsurface = wl_subcompositor_get_subsurface(subcompositor, surface, source);
-        wl_subsurface_set_desync(subsurface);
-        egl_display = eglGetDisplay(display);
-        egl_context = eglCreateContext (egl_display, config, EGL_NO_CONTEXT, NULL);
-        eglInitialize(egl_display, NULL, NULL);
+        init(compositor, subcompositor, source, config, context, 1, 1);
         wl_subsurface_set_position(subsurface, 0, 0);
-        egl_window = wl_egl_window_create(surface, 1, 1);
-        egl_surface = eglCreateWindowSurface(egl_display, config, egl_window, NULL);
+        text_x = active_theme.title_text_x;
+        text_y = (title_bar_size-glyph_height)/2;
+        if(type==XDG_TOPLEVEL_RESIZE_EDGE_NONE && viewport && decoration_pool.data) {
+            create_label(compositor, subcompositor);
+        }
     }
 
-    ~decoration() {
-//        wl_subsurface_destroy(subsurface);
-//        wl_subcompositor_destroy(subcompositor);
+    // drawn on the CPU into a buffer of the decoration pool, only again when the title changes
+    void create_label(wl_compositor* compositor, wl_subcompositor* subcompositor) {
+        label.reset(new element);
+        label->name = "label";
+        label->r=r; label->g=g; label->b=b; label->a=a;
+        label->init(compositor, subcompositor, surface, NULL, egl_context, 1, glyph_height, false, true);
+        wl_subsurface_set_position(label->subsurface, text_x, text_y);
+        // the pointer passes through to the title bar
+        struct wl_region *input = wl_compositor_create_region(compositor);
+        wl_surface_set_input_region(label->surface, input);
+        wl_region_destroy(input);
+        wl_surface_set_user_data(label->surface, this);
     }
 
-    void calc_dim(const int main_w, const int main_h, int &x, int &y, int &w, int &h) {
-        // get position and dimension from type and main surface
-        switch (function) {
-        case XDG_TOPLEVEL_RESIZE_EDGE_NONE:
-            x=0; y=-title_bar_size;
-            w=main_w; h=title_bar_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_TOP:
-            x=0; y=-title_bar_size-border_size;
-            w=main_w; h=border_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM:
-            x=0; y=main_h;
-            w=main_w; h=border_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_LEFT:
-            x=-border_size; y=-title_bar_size;
-            w=border_size; h=main_h+title_bar_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT:
-            x=-border_size; y=-border_size-title_bar_size;
-            w=border_size; h=border_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT:
-            x=-border_size; y=main_h;
-            w=border_size; h=border_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_RIGHT:
-            x=main_w; y=-title_bar_size;
-            w=border_size; h=main_h+title_bar_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT:
-            x=main_w; y=-border_size-title_bar_size;
-            w=border_size; h=border_size;
-            break;
-        case XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT:
-            x=main_w; y=main_h;
-            w=border_size; h=border_size;
-            break;
+    // returns true if the title changed, solid title bars only keep it for the label
+    bool set_title(const std::string &title) {
+        if(!text.set(title)) {
+            return false;
+        }
+        if(!viewport) {
+            dirty = true;
+        }
+        if(label) {
+            label->text.set(title);
+            label->dirty = true;
+            resize_label();
         }
+        return true;
     }
 
-    void resize(const int main_w, const int main_h) {
-        int x,y,w,h;
-        calc_dim(main_w, main_h, x, y, w, h);
-        wl_subsurface_set_position(subsurface, x, y);
-//        egl_window = wl_egl_window_create(surface, w, h);
-        wl_egl_window_resize(egl_window, w, h, 0, 0);
-
+    // the label is as wide as the text, clipped to the title bar
+    void resize_label() {
+        const int text_w = int(label->text.text.size())*glyph_advance;
+        label->set_size(std::max(1, std::min(text_w, title_width-text_x)), glyph_height);
     }
 
-    void draw() const {
-        eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context);
-        //glClearColor(1.0, 1.0, 0.0, 1.0);
-        glClearColor(r, g, b, a);
-        glClear(GL_COLOR_BUFFER_BIT);
-        eglSwapBuffers(egl_display, egl_surface);
+    // 'geometry' is the evaluated decoration_layout, indexed by the edge
+    void resize(const std::vector<layout_rect> &geometry) {
+        const layout_rect &rect = geometry[function];
+        wl_subsurface_set_position(subsurface, rect.x, rect.y);
+        set_size(rect.w, rect.h);
+        if(label) {
+            title_width = rect.w;
+            resize_label();
+        }
     }
-};
 
-static const std::map<enum xdg_toplevel_resize_edge, std::string> resize_cursor = {
-    {XDG_TOPLEVEL_RESIZE_EDGE_NONE, "grabbing"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_TOP, "top_side"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM, "bottom_side"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_LEFT, "left_side"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT, "top_left_corner"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT, "bottom_left_corner"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_RIGHT, "right_side"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT, "top_right_corner"},
-    {XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT, "bottom_right_corner"}
+    bool draw() {
+        const bool committed = element::draw();
+        if(label) { label->draw(); }
+        return committed;
+    }
 };
 
-void window_resize(struct window *window, const int width, const int height, bool full);
-
-// listeners
-
-static void xdg_surface_handle_configure(void *data,
-        struct xdg_surface *xdg_surface, uint32_t serial) {
-    xdg_surface_ack_configure(xdg_surface, serial);
-}
+// all decoration elements drawn into a single subsurface below the main surface,
+// hit testing is done on pointer coordinates with a precomputed region table
+struct frame : element {
+    struct region {
+        int x, y, w, h;         // in frame surface coordinates
+        enum xdg_toplevel_resize_edge edge;
+        int button;             // button::type or -1
+        double base[4];
+        double r, g, b, a;
+        bool dirty;
+    };
+
+    std::vector<region> regions;    // in drawing order, the last region on top
+    uint border_size;
+    uint title_bar_size;
+    // software mode: shadow around the frame, outside of the input region, and corner radius
+    int margin = 0;
+    int radius = 0;
 
-static const struct xdg_surface_listener xdg_surface_listener = {
-    .configure = xdg_surface_handle_configure,
-};
+    // button interaction state
+    int hovered_button = -1;
+    bool pressed = false;
+    bool maximised = false;
 
-void xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height, struct wl_array *states) {
-    if (width==0 || height==0)
-        return;
-    struct window *window = static_cast<struct window*>(data);
-    window_resize(window, width, height, true);
-}
+    frame(wl_compositor* compositor, wl_subcompositor* subcompositor, wl_surface* source,
+          const uint _border_size, const uint _title_bar_size, EGLConfig config, EGLContext context)
+    {
+        r=0; g=0; b=0; a=0;
+        name = "frame";
+        border_size = _border_size;
+        title_bar_size = _title_bar_size;
+        init(compositor, subcompositor, source, config, context, 1, 1, false);
+        if(software) {
+            margin = frame_shadow;
+            radius = border_size;
+        }
+        wl_subsurface_place_below(subsurface, source);
+        wl_subsurface_set_position(subsurface, -border_size-margin, -border_size-title_bar_size-margin);
+    }
 
-static void xdg_toplevel_handle_close(void *data, struct xdg_toplevel *xdg_toplevel) {
-    running = false;
-}
+    // 'rect' in main surface coordinates
+    void add_region(const layout_rect &rect, const enum xdg_toplevel_resize_edge edge, const int button, const double color[4]) {
+        region reg = {};
+        // shift from main surface into frame coordinates
+        reg.x = rect.x+border_size+margin;
+        reg.y = rect.y+border_size+title_bar_size+margin;
+        reg.w = rect.w;
+        reg.h = rect.h;
+        reg.edge = edge;
+        reg.button = button;
+        std::copy(color, color+4, reg.base);
+        // drawn once, update_colors() then only marks changed colors
+        reg.dirty = true;
+        regions.push_back(reg);
+    }
 
-static const struct xdg_toplevel_listener xdg_toplevel_listener = {
-    .configure = xdg_toplevel_handle_configure,
-    .close = xdg_toplevel_handle_close,
-};
+    // 'geometry' is the evaluated decoration_layout
+    void resize(const int main_w, const int main_h, const std::vector<layout_rect> &geometry) {
+        const int w = main_w+2*border_size+2*margin;
+        const int h = main_h+2*border_size+title_bar_size+2*margin;
+        if(w==width && h==height && !regions.empty()) {
+            return;
+        }
+        set_size(w, h);
+        if(margin) {
+            // the pointer passes through the shadow
+            struct wl_region *input = wl_compositor_create_region(compositor);
+            wl_region_add(input, margin, margin, w-2*margin, h-2*margin);
+            wl_surface_set_input_region(surface, input);
+            wl_region_destroy(input);
+        }
 
-void xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
-    xdg_wm_base_pong(xdg_wm_base, serial);
-}
+        regions.clear();
+        for(const enum xdg_toplevel_resize_edge edge : decoration_edges) {
+            add_region(geometry[edge], edge, -1, active_theme.color(edge));
+        }
+        // buttons are relative to the title bar
+        const layout_rect &title = geometry[XDG_TOPLEVEL_RESIZE_EDGE_NONE];
+        for(size_t i = 0; i<active_theme.buttons.size(); i++) {
+            layout_rect rect = geometry[layout_table::first_button+i];
+            rect.x += title.x;
+            rect.y += title.y;
+            const theme_button &tb = active_theme.buttons[i];
+            add_region(rect, XDG_TOPLEVEL_RESIZE_EDGE_NONE, tb.function, tb.color);
+        }
+        update_colors();
+    }
 
-static const struct xdg_wm_base_listener xdg_wm_base_listener {
-    .ping = xdg_wm_base_ping
-};
+    void update_colors() {
+        for(region &reg : regions) {
+            double c[4];
+            if(reg.button<0) {
+                std::copy(reg.base, reg.base+4, c);
+            }
+            else {
+                button_color(reg.base, hovered_button==reg.button, pressed && hovered_button==reg.button,
+                             reg.button==button::type::MAXIMISE && maximised, c);
+            }
+            if(c[0]!=reg.r || c[1]!=reg.g || c[2]!=reg.b || c[3]!=reg.a) {
+                reg.r=c[0]; reg.g=c[1]; reg.b=c[2]; reg.a=c[3];
+                reg.dirty = true;
+            }
+        }
+    }
 
-static void pointer_enter (void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface, wl_fixed_t surface_x, wl_fixed_t surface_y) {
-    window *w = static_cast<window*>(data);
-    w->current_surface = surface;
+    void set_state(int _hovered_button, bool _pressed, bool _maximised) {
+        hovered_button = _hovered_button;
+        pressed = _pressed;
+        maximised = _maximised;
+        update_colors();
+    }
 
-    std::string cursor = "left_ptr";
+    bool needs_redraw() const {
+        if(dirty || full_redraw) {
+            return true;
+        }
+        for(const region &reg : regions) {
+            if(reg.dirty) { return true; }
+        }
+        return false;
+    }
 
-    for(const decoration &d: w->decorations) {
-        if(d.surface==surface) {
-            if(resize_cursor.count(d.function)) {
-                cursor = resize_cursor.at(d.function);
+    // index of the top-most region at frame coordinates, or -1
+    int hit(const int x, const int y) const {
+        for(int i = int(regions.size())-1; i>=0; i--) {
+            const region &reg = regions[i];
+            if(x>=reg.x && x<reg.x+reg.w && y>=reg.y && y<reg.y+reg.h) {
+                return i;
             }
         }
+        return -1;
     }
 
-    const auto image = wl_cursor_theme_get_cursor(cursor_theme, cursor.c_str())->images[0];
-    wl_pointer_set_cursor(pointer, serial, cursor_surface, image->hotspot_x, image->hotspot_y);
-    wl_surface_attach(cursor_surface, wl_cursor_image_get_buffer(image), 0, 0);
-    wl_surface_damage(cursor_surface, 0, 0, image->width, image->height);
-    wl_surface_commit(cursor_surface);
-}
-
-static void pointer_leave (void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface) {
-    window *w = static_cast<window*>(data);
-    w->button_pressed = false;
-}
-
-static void pointer_motion (void *data, struct wl_pointer *pointer, uint32_t time, wl_fixed_t x, wl_fixed_t y) {
-//    std::cout << "pointer motion " << wl_fixed_to_double(x) << " " << wl_fixed_to_double(y) << std::endl;
-}
+    bool draw() {
+        if(!needs_redraw()) {
+            return false;
+        }
+        if(software) {
+            return draw_software();
+        }
 
-static void pointer_button (void *data, struct wl_pointer *pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state) {
-//    std::cout << "pointer button " << button << ", state " << state << std::endl;
+        // the whole buffer is redrawn, but only changed regions are reported as damage
+        std::vector<EGLint> damage;
+        if(dirty || full_redraw) {
+            damage = {0, 0, width, height};
+        }
+        else {
+            for(const region &reg : regions) {
+                if(reg.dirty) { damage.insert(damage.end(), {reg.x, reg.y, reg.w, reg.h}); }
+            }
+        }
 
-    window *w = static_cast<window*>(data);
-    w->button_pressed = (button==BTN_LEFT) && (state==WL_POINTER_BUTTON_STATE_PRESSED);
+        make_current(egl_surface, egl_context, name);
+        {
+            TRACE_SCOPE("glClear", name);
+            glClearColor(0, 0, 0, 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glEnable(GL_SCISSOR_TEST);
+            for(region &reg : regions) {
+                // GL origin is bottom left
+                glScissor(reg.x, height-reg.y-reg.h, reg.w, reg.h);
+                glClearColor(reg.r, reg.g, reg.b, reg.a);
+                glClear(GL_COLOR_BUFFER_BIT);
+                reg.dirty = false;
+            }
+            glDisable(GL_SCISSOR_TEST);
+        }
+        text.draw(egl_context, border_size+active_theme.title_text_x, border_size+(title_bar_size-glyph_height)/2, width, height);
+        swap_buffers(egl_surface, height, damage, name);
+        dirty = false;
+        return true;
+    }
 
-    if(w->button_pressed) {
-        for(int i = 0; i<w->decorations.size(); i++) {
-            if(w->decorations[i].surface==w->current_surface) {
-                switch(w->decorations[i].function) {
-                case XDG_TOPLEVEL_RESIZE_EDGE_NONE:
-                    if(w->xdg_toplevel) {
-                        xdg_toplevel_move(w->xdg_toplevel, seat, serial);
-                    }
-                    break;
-                default:
-                    if(w->xdg_toplevel) {
-                        xdg_toplevel_resize(w->xdg_toplevel, seat, serial, w->decorations[i].function);
-                    }
-                    break;
-                }
+    // draw the regions inside of (x, y, w, h) and round the frame corners in it
+    void paint(const canvas &c, int x, int y, int w, int h) {
+        const int fx = margin;
+        const int fy = margin;
+        const int fw = width-2*margin;
+        const int fh = height-2*margin;
+        const int cx[4] = {fx, fx+fw-radius, fx, fx+fw-radius};
+        const int cy[4] = {fy, fy, fy+fh-radius, fy+fh-radius};
+        auto overlaps = [&](const int rx, const int ry, const int rw, const int rh) {
+            return rx<x+w && x<rx+rw && ry<y+h && y<ry+rh;
+        };
+        // corners are blended with the shadow, so they are always drawn whole
+        for(int i = 0; i<4; i++) {
+            if(overlaps(cx[i], cy[i], radius, radius)) {
+                const int x1 = std::max(x+w, cx[i]+radius);
+                const int y1 = std::max(y+h, cy[i]+radius);
+                x = std::min(x, cx[i]);
+                y = std::min(y, cy[i]);
+                w = x1-x;
+                h = y1-y;
+            }
+        }
+        for(const region &reg : regions) {
+            if(!overlaps(reg.x, reg.y, reg.w, reg.h)) {
+                continue;
+            }
+            const int x0 = std::max(x, reg.x);
+            const int y0 = std::max(y, reg.y);
+            const int x1 = std::min(x+w, reg.x+reg.w);
+            const int y1 = std::min(y+h, reg.y+reg.h);
+            fill_rect(c, x0, y0, x1-x0, y1-y0, premultiply(reg.r, reg.g, reg.b, reg.a));
+            if(&reg==&regions[0]) {
+                // the title is clipped to the title bar
+                const canvas clip = {c.row(y0)+x0, x1-x0, y1-y0, c.stride};
+                text.draw(clip, reg.x+active_theme.title_text_x-x0, reg.y+(title_bar_size-glyph_height)/2-y0);
+            }
+        }
+        for(int i = 0; i<4; i++) {
+            if(overlaps(cx[i], cy[i], radius, radius)) {
+                round_corner(c, fx, fy, fw, fh, i, margin, radius, 1);
             }
         }
+    }
 
-        for(const struct button &b: w->buttons) {
-            if(b.surface==w->current_surface) {
-                switch (b.function) {
-                case button::type::CLOSE:
-                    running = false;
-                    break;
-                case button::type::MAXIMISE:
-                    if(w->maximised) {
-                        if(w->xdg_toplevel) {
-                            xdg_toplevel_unset_maximized(w->xdg_toplevel);
-                        }
-                    }
-                    else {
-                        // store original window size
-//                        wl_egl_window_get_attached_size(w->egl_window, &w->width, &w->height);
-                        if(w->xdg_toplevel) {
-                            xdg_toplevel_set_maximized(w->xdg_toplevel);
-                        }
-                    }
-                    w->maximised = !w->maximised;
-                    break;
-                case button::type::MINIMISE:
-                    if(w->xdg_toplevel) {
-                        xdg_toplevel_set_minimized(w->xdg_toplevel);
-                    }
-                    break;
+    // CPU drawing into the decoration pool, only the changed regions are drawn
+    // again if the compositor released the last buffer before this frame
+    bool draw_software() {
+        TRACE_SCOPE("draw_software", name);
+        bool valid;
+        shm_buffer *buf = swapchain.acquire(decoration_pool, width, height, valid);
+        if(!buf) {
+            return false;
+        }
+        const canvas c = buf->pixels();
+        std::vector<int> damage;
+        if(!valid || dirty || full_redraw) {
+            fill_rect(c, 0, 0, width, height, 0);
+            draw_shadow(c, margin, margin, width-2*margin, height-2*margin, margin, radius, 1);
+            paint(c, 0, 0, width, height);
+            damage = {0, 0, width, height};
+        }
+        else {
+            for(const region &reg : regions) {
+                if(reg.dirty) {
+                    paint(c, reg.x, reg.y, reg.w, reg.h);
+                    damage.insert(damage.end(), {reg.x, reg.y, reg.w, reg.h});
                 }
             }
         }
+        for(region &reg : regions) { reg.dirty = false; }
+        swapchain.attach(surface, buf);
+        for(size_t i = 0; i+3<damage.size(); i+=4) {
+            damage_buffer(surface, damage[i], damage[i+1], damage[i+2], damage[i+3]);
+        }
+        commit(surface);
+        dirty = false;
+        return true;
     }
-}
+};
 
-static void pointer_axis (void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis, wl_fixed_t value) {
-}
+// cursor shapes indexed by resize edge, the title bar (edge NONE) moves the window
+static const int cursor_default = XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT+1;
+static const int cursor_count = cursor_default+1;
+static const char *cursor_names[cursor_count] = {
+    "grabbing",             // XDG_TOPLEVEL_RESIZE_EDGE_NONE
+    "top_side",             // XDG_TOPLEVEL_RESIZE_EDGE_TOP
+    "bottom_side",          // XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM
+    "left_ptr",
+    "left_side",            // XDG_TOPLEVEL_RESIZE_EDGE_LEFT
+    "top_left_corner",      // XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT
+    "bottom_left_corner",   // XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT
+    "left_ptr",
+    "right_side",           // XDG_TOPLEVEL_RESIZE_EDGE_RIGHT
+    "top_right_corner",     // XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT
+    "bottom_right_corner",  // XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT
+    "left_ptr",             // cursor_default
+};
 
-static struct wl_pointer_listener pointer_listener = {&pointer_enter, &pointer_leave, &pointer_motion, &pointer_button, &pointer_axis};
+// all cursors of the theme at one output scale, resolved when the scale is first used
+struct cursor_set {
+    struct wl_cursor_theme *theme = NULL;
+    struct wl_cursor *cursors[cursor_count] = {};
+};
 
-static void seat_capabilities (void *data, struct wl_seat *seat, uint32_t capabilities) {
-    if (capabilities & WL_SEAT_CAPABILITY_POINTER) {
-        struct wl_pointer *pointer = wl_seat_get_pointer (seat);
-        wl_pointer_add_listener (pointer, &pointer_listener, data);
-        cursor_surface = wl_compositor_create_surface(compositor);
-    }
-//    if (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) {
-//        struct wl_keyboard *keyboard = wl_seat_get_keyboard (seat);
-//        wl_keyboard_add_listener (keyboard, &keyboard_listener, NULL);
-//    }
-}
-static struct wl_seat_listener seat_listener = {&seat_capabilities};
+static std::map<int32_t, cursor_set> cursor_sets;
 
-static void registry_add_object (void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
-    if (!strcmp(interface,"wl_compositor")) {
-        compositor = static_cast<wl_compositor*>(wl_registry_bind (registry, name, &wl_compositor_interface, 1));
-    }
-    else if (strcmp(interface, "wl_subcompositor") == 0) {
-        subcompositor = static_cast<wl_subcompositor*>(wl_registry_bind(registry, name, &wl_subcompositor_interface, 1));
-    }
-    else if (!strcmp(interface,"wl_seat")) {
-        seat = static_cast<wl_seat*>(wl_registry_bind (registry, name, &wl_seat_interface, 1));
-        wl_seat_add_listener (seat, &seat_listener, data);
-    }
-    else if (strcmp(interface, "wl_shm") == 0) {
-        shm = static_cast<wl_shm*>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
-        cursor_theme = wl_cursor_theme_load(nullptr, 32, shm);
+static const cursor_set &get_cursor_set(const int32_t scale) {
+    auto it = cursor_sets.find(scale);
+    if(it!=cursor_sets.end()) {
+        return it->second;
     }
-    else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
-        xdg_wm_base = static_cast<struct xdg_wm_base*>(wl_registry_bind(registry, name, &xdg_wm_base_interface, MIN(version, 2)));
+    TRACE_SCOPE("wl_cursor_theme_load");
+    cursor_set &set = cursor_sets[scale];
+    set.theme = wl_cursor_theme_load(nullptr, 32*scale, shm);
+    if(set.theme) {
+        struct wl_cursor *fallback = wl_cursor_theme_get_cursor(set.theme, cursor_names[cursor_default]);
+        for(int i = 0; i<cursor_count; i++) {
+            set.cursors[i] = wl_cursor_theme_get_cursor(set.theme, cursor_names[i]);
+            if(!set.cursors[i]) { set.cursors[i] = fallback; }
+        }
     }
+    return set;
 }
 
-static void registry_remove_object (void *data, struct wl_registry *registry, uint32_t name) {
+bool window_resize(struct window *window, const int width, const int height, bool full);
 
-}
+static void update_decoration_state(window *w);
 
-static struct wl_registry_listener registry_listener = {&registry_add_object, &registry_remove_object};
+// presentation feedback, when the frames of the main surfaces reach the screen
+static bool pacing = false;             // start drawing as late as possible before the next refresh
+static const uint64_t pacing_margin = 2000000;     // ns
+static frame_stats presentation_stats;
 
-static void shell_surface_ping (void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
-    wl_shell_surface_pong (shell_surface, serial);
+struct frame_feedback {
+    wl_handle<struct wp_presentation_feedback, wp_presentation_feedback_destroy> feedback;
+    struct window *window;
+    uint64_t input_time;                // ns, 0 without input
+    uint64_t target_msc;                // first refresh after the commit, 0 if unknown
+};
+
+static uint64_t presentation_now() {
+    struct timespec ts;
+    clock_gettime(presentation_clock, &ts);
+    return uint64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
 }
 
-static void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height) {
-    struct window *window = static_cast<struct window*>(data);
-//    std::cout << "config " << edges << " " << width << " " << height << std::endl;
-    window_resize(window, width, height, true);
+// the first commit of a main surface, after its buffer was attached
+static void stamp_first_commit() {
+    uint64_t expected = 0;
+    if(first_commit.compare_exchange_strong(expected, trace_now())) {
+        std::cout << "time to first commit: " << (first_commit-process_start)/1e6 << " ms" << std::endl;
+    }
 }
 
-static void shell_surface_popup_done (void *data, struct wl_shell_surface *shell_surface) {
+// 'time' in the presentation clock
+static void stamp_first_presentation(const uint64_t time) {
+    if(!first_presentation) {
+        // the presentation clock may differ, go back from now in both clocks
+        first_presentation = trace_now() - std::min(trace_now()-process_start, presentation_now()-time);
+        std::cout << "time to first frame: " << (first_presentation-process_start)/1e6 << " ms" << std::endl;
+    }
+}
 
+static void finish_feedback(frame_feedback *f) {
+    auto &feedbacks = f->window->feedbacks;
+    for(auto it = feedbacks.begin(); it!=feedbacks.end(); ++it) {
+        if(it->get()==f) {
+            feedbacks.erase(it);
+            return;
+        }
+    }
 }
 
-static struct wl_shell_surface_listener shell_surface_listener = {&shell_surface_ping, &shell_surface_configure, &shell_surface_popup_done};
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output) {
+}
 
+static void feedback_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                               uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+    frame_feedback *f = static_cast<frame_feedback*>(data);
+    struct window *w = f->window;
+    const uint64_t time = ((uint64_t(tv_sec_hi)<<32) | tv_sec_lo)*1000000000 + tv_nsec;
+    const uint64_t msc = (uint64_t(seq_hi)<<32) | seq_lo;
+    w->last_presentation = time;
+    w->refresh = refresh;
+    // the refresh counter is only meaningful for outputs with vertical sync
+    const bool vsync = (flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) && msc;
+    w->last_msc = vsync ? msc : 0;
+    stamp_first_presentation(time);
+    presentation_stats.present(msc, vsync ? f->target_msc : 0,
+                               (f->input_time && time>f->input_time) ? (time-f->input_time)/1e6 : -1);
+    finish_feedback(f);
+}
 
-static void create_window(struct window *window, int32_t width, int32_t height) {
-    const uint border_size = 5;
-    const uint title_size = 15;
-    eglBindAPI (EGL_OPENGL_API);
-    EGLint attributes[] = {
-        EGL_RED_SIZE, 8,
-        EGL_GREEN_SIZE, 8,
-        EGL_BLUE_SIZE, 8,
-        EGL_ALPHA_SIZE, 8,
-        EGL_NONE};
-    EGLConfig config;
-    EGLint num_config;
-    eglChooseConfig(egl_display, attributes, &config, 1, &num_config);
-    window->egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, NULL);
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    presentation_stats.discard();
+    finish_feedback(static_cast<frame_feedback*>(data));
+}
 
-    window->width = width;
-    window->height = height;
-    window->border_size = border_size;
-    window->title_size = title_size;
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = feedback_presented,
+    .discarded = feedback_discarded,
+};
 
-    window->surface = wl_compositor_create_surface (compositor);
+// request feedback for the next commit of the main surface
+static void request_feedback(struct window *window) {
+    if(!presentation) {
+        return;
+    }
+    frame_feedback *f = new frame_feedback;
+    f->feedback = wp_presentation_feedback(presentation, window->surface);
+    f->window = window;
+    f->input_time = window->input_time;
+    f->target_msc = 0;
+    if(window->last_msc && window->refresh) {
+        const uint64_t now = presentation_now();
+        f->target_msc = window->last_msc + (now>window->last_presentation ? (now-window->last_presentation)/window->refresh+1 : 1);
+    }
+    window->input_time = 0;
+    wp_presentation_feedback_add_listener(f->feedback, &feedback_listener, f);
+    window->feedbacks.emplace_back(f);
+}
 
-    if(xdg_wm_base) {
+// ms until a window should start drawing to be shown at the next refresh it can make
+static int paced_delay(const struct window *window) {
+    if(!window->refresh || !window->last_presentation) {
+        return 0;
+    }
+    const uint64_t now = presentation_now();
+    const uint64_t budget = uint64_t(window->render_time) + pacing_margin;
+    if(now+budget<=window->last_presentation) {
+        return 0;
+    }
+    const uint64_t cycles = (now+budget-window->last_presentation + window->refresh-1)/window->refresh;
+    const uint64_t start = window->last_presentation + cycles*window->refresh - budget;
+    return (start>now) ? int((start-now)/1000000) : 0;
+}
+
+// remember the first input that changes the window, for the input-to-photon latency
+static void mark_input(struct window *window) {
+    if(presentation && window->dirty && !window->input_time) {
+        window->input_time = presentation_now();
+    }
+}
+
+// Hidden windows are not drawn, only configures are acknowledged. Minimised
+// windows are not known to the client, they are throttled by the frame
+// callbacks that the compositor does not send while they are not shown.
+static bool window_idle(const window *w) {
+    return w->state.suspended;
+}
+
+// listeners
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    struct window *window = static_cast<struct window*>(data);
+    window->frame_callback.reset();
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_done,
+};
+
+static void xdg_surface_handle_configure(void *data,
+        struct xdg_surface *xdg_surface, uint32_t serial) {
+    struct window *window = static_cast<struct window*>(data);
+    window->state = window->pending_state;
+    window->maximised = window->state.maximised;
+    update_decoration_state(window);
+    // acknowledged together with the matching commit in draw_window()
+    window->configure_pending = true;
+    window->configure_serial = serial;
+    window->configured = true;
+    window->dirty = true;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_handle_configure,
+};
+
+static void request_resize(struct window *window, const int width, const int height, bool full) {
+    if(!window->resize_pending) {
+        window->pending_since = std::chrono::steady_clock::now();
+    }
+    window->resize_pending = true;
+    window->pending_width = width;
+    window->pending_height = height;
+    window->pending_full = full;
+    window->dirty = true;
+}
+
+void xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height, struct wl_array *states) {
+    struct window *window = static_cast<struct window*>(data);
+    window->pending_state = window::toplevel_state();
+    const uint32_t *state = static_cast<const uint32_t*>(states->data);
+    for(size_t i = 0; i<states->size/sizeof(uint32_t); i++) {
+        switch(state[i]) {
+        case XDG_TOPLEVEL_STATE_MAXIMIZED:
+            window->pending_state.maximised = true;
+            break;
+        case XDG_TOPLEVEL_STATE_ACTIVATED:
+            window->pending_state.activated = true;
+            break;
+        case XDG_TOPLEVEL_STATE_RESIZING:
+            window->pending_state.resizing = true;
+            break;
+        case XDG_TOPLEVEL_STATE_TILED_LEFT:
+        case XDG_TOPLEVEL_STATE_TILED_RIGHT:
+        case XDG_TOPLEVEL_STATE_TILED_TOP:
+        case XDG_TOPLEVEL_STATE_TILED_BOTTOM:
+            window->pending_state.tiled = true;
+            break;
+#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+        case XDG_TOPLEVEL_STATE_SUSPENDED:
+            window->pending_state.suspended = true;
+            break;
+#endif
+        }
+    }
+    if (width==0 || height==0)
+        return;
+    request_resize(window, width, height, true);
+}
+
+static void xdg_toplevel_handle_close(void *data, struct xdg_toplevel *xdg_toplevel) {
+    struct window *window = static_cast<struct window*>(data);
+    window->closed = true;
+}
+
+#ifdef XDG_TOPLEVEL_CONFIGURE_BOUNDS_SINCE_VERSION
+static void xdg_toplevel_handle_configure_bounds(void *data, struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height) {
+}
+#endif
+
+#ifdef XDG_TOPLEVEL_WM_CAPABILITIES_SINCE_VERSION
+static void xdg_toplevel_handle_wm_capabilities(void *data, struct xdg_toplevel *xdg_toplevel, struct wl_array *capabilities) {
+}
+#endif
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_handle_configure,
+    .close = xdg_toplevel_handle_close,
+#ifdef XDG_TOPLEVEL_CONFIGURE_BOUNDS_SINCE_VERSION
+    .configure_bounds = xdg_toplevel_handle_configure_bounds,
+#endif
+#ifdef XDG_TOPLEVEL_WM_CAPABILITIES_SINCE_VERSION
+    .wm_capabilities = xdg_toplevel_handle_wm_capabilities,
+#endif
+};
+
+void xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener {
+    .ping = xdg_wm_base_ping
+};
+
+static void toplevel_decoration_configure(void *data, struct zxdg_toplevel_decoration_v1 *toplevel_decoration, uint32_t mode) {
+    struct window *window = static_cast<struct window*>(data);
+    window->decoration_mode_pending = true;
+    window->pending_server_side = (mode==ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
+    window->dirty = true;
+}
+
+static const struct zxdg_toplevel_decoration_v1_listener toplevel_decoration_listener = {
+    .configure = toplevel_decoration_configure,
+};
+
+// image shown on the cursor surface, to skip redundant updates
+static struct {
+    struct wl_cursor *cursor = NULL;
+    int shape = -1;
+    int32_t scale = 0;
+    int image = -1;                     // index of the attached animation frame
+    uint32_t animation_start = 0;       // ms, time of the first frame callback
+    struct wl_callback *frame_callback = NULL;
+} cursor_state;
+
+static void cursor_frame_done(void *data, struct wl_callback *callback, uint32_t time);
+
+static const struct wl_callback_listener cursor_frame_listener = {
+    .done = cursor_frame_done,
+};
+
+// attach an animation frame and request the next frame callback for animated cursors
+static void cursor_commit(const int image) {
+    if(image!=cursor_state.image) {
+        struct wl_cursor_image *img = cursor_state.cursor->images[image];
+        wl_surface_attach(cursor_surface, wl_cursor_image_get_buffer(img), 0, 0);
+        wl_surface_damage(cursor_surface, 0, 0, img->width, img->height);
+        cursor_state.image = image;
+    }
+    if(cursor_state.cursor->image_count>1 && !cursor_state.frame_callback) {
+        cursor_state.frame_callback = wl_surface_frame(cursor_surface);
+        wl_callback_add_listener(cursor_state.frame_callback, &cursor_frame_listener, NULL);
+    }
+    wl_surface_commit(cursor_surface);
+}
+
+static void cursor_frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    wl_callback_destroy(callback);
+    cursor_state.frame_callback = NULL;
+    if(!cursor_state.cursor || cursor_state.cursor->image_count<2) {
+        return;
+    }
+    if(!cursor_state.animation_start) {
+        cursor_state.animation_start = time;
+    }
+    cursor_commit(wl_cursor_frame(cursor_state.cursor, time-cursor_state.animation_start));
+}
+
+// largest scale of the outputs a window is shown on
+static int32_t window_scale(const window *w) {
+    int32_t scale = 1;
+    for(const output *o : w->outputs) { scale = std::max(scale, o->scale); }
+    return scale;
+}
+
+// show a cursor shape, 'enter' is set for the first cursor after a pointer enter
+static void set_cursor(struct wl_pointer *pointer, uint32_t serial, const int shape, const int32_t scale, bool enter) {
+    if(!enter && shape==cursor_state.shape && scale==cursor_state.scale) {
+        return;
+    }
+    TRACE_SCOPE("set_cursor");
+    struct wl_cursor *cursor = get_cursor_set(scale).cursors[shape];
+    if(!cursor) {
+        return;
+    }
+    if(cursor!=cursor_state.cursor || scale!=cursor_state.scale) {
+        // a new image, the buffer is only replaced if the shape actually changed
+        cursor_state.cursor = cursor;
+        cursor_state.image = -1;
+        cursor_state.animation_start = 0;
+        if(wl_surface_get_version(cursor_surface)>=WL_SURFACE_SET_BUFFER_SCALE_SINCE_VERSION) {
+            wl_surface_set_buffer_scale(cursor_surface, scale);
+        }
+        cursor_commit(0);
+    }
+    cursor_state.shape = shape;
+    cursor_state.scale = scale;
+    // the role is assigned per enter serial, the surface content is kept
+    const struct wl_cursor_image *image = cursor->images[0];
+    wl_pointer_set_cursor(pointer, serial, cursor_surface, image->hotspot_x/scale, image->hotspot_y/scale);
+}
+
+static int region_cursor(const window *w) {
+    if(w->current_region<0) {
+        return cursor_default;
+    }
+    const frame::region &reg = w->frame_surface->regions[w->current_region];
+    return (reg.button<0) ? reg.edge : cursor_default;
+}
+
+static void toggle_maximise(window *w) {
+    if(w->maximised) {
+        if(w->xdg_toplevel) {
+            xdg_toplevel_unset_maximized(w->xdg_toplevel);
+        }
+    }
+    else {
+        // store original window size
+//        wl_egl_window_get_attached_size(w->egl_window, &w->width, &w->height);
+        if(w->xdg_toplevel) {
+            xdg_toplevel_set_maximized(w->xdg_toplevel);
+        }
+    }
+    // 'maximised' follows the state of the next configure
+}
+
+// update the button appearance and schedule a redraw if it changed
+static void update_decoration_state(window *w) {
+    // inactive windows are drawn without hover effects
+    const int hovered_button = w->state.activated ? w->hovered_button : -1;
+    bool changed = false;
+    for(button &b : w->buttons) {
+        const bool hovered = (hovered_button==b.function);
+        b.set_state(hovered, hovered && w->button_pressed, b.function==button::type::MAXIMISE && w->maximised);
+        changed |= b.dirty;
+    }
+    if(w->frame_surface) {
+        w->frame_surface->set_state(hovered_button, w->button_pressed, w->maximised);
+        changed |= w->frame_surface->needs_redraw();
+    }
+    w->dirty |= changed;
+}
+
+// the seat has one pointer, it focuses at most one window at a time
+static struct {
+    struct wl_pointer *pointer = NULL;
+    uint32_t serial = 0;                // serial of the last pointer enter
+    struct window *focus = NULL;
+} pointer_state;
+
+// window and element of a surface, NULL for surfaces that are not ours (e.g. destroyed)
+static const surface_owner *get_owner(struct wl_surface *surface) {
+    return surface ? static_cast<const surface_owner*>(wl_surface_get_user_data(surface)) : NULL;
+}
+
+static void pointer_enter (void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface, wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    pointer_state.pointer = pointer;
+    pointer_state.serial = serial;
+
+    const surface_owner *owner = get_owner(surface);
+    if(!owner) {
+        pointer_state.focus = NULL;
+        return;
+    }
+    window *w = owner->window;
+    pointer_state.focus = w;
+    w->current_owner = owner;
+
+    int cursor = cursor_default;
+
+    w->hovered_button = -1;
+
+    switch(owner->kind) {
+    case surface_owner::FRAME:
+        w->current_region = w->frame_surface->hit(wl_fixed_to_int(surface_x), wl_fixed_to_int(surface_y));
+        cursor = region_cursor(w);
+        if(w->current_region>=0) {
+            w->hovered_button = w->frame_surface->regions[w->current_region].button;
+        }
+        break;
+    case surface_owner::DECORATION:
+        cursor = static_cast<const decoration*>(owner)->function;
+        break;
+    case surface_owner::BUTTON:
+        w->hovered_button = static_cast<const struct button*>(owner)->function;
+        break;
+    case surface_owner::CONTENT:
+        break;
+    }
+
+    set_cursor(pointer, serial, cursor, window_scale(w), true);
+    update_decoration_state(w);
+}
+
+static void pointer_leave (void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface) {
+    window *w = pointer_state.focus;
+    pointer_state.focus = NULL;
+    if(!w) {
+        return;
+    }
+    w->button_pressed = false;
+    w->current_owner = NULL;
+    w->current_region = -1;
+    w->hovered_button = -1;
+    update_decoration_state(w);
+}
+
+static void pointer_motion (void *data, struct wl_pointer *pointer, uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+//    std::cout << "pointer motion " << wl_fixed_to_double(x) << " " << wl_fixed_to_double(y) << std::endl;
+    window *w = pointer_state.focus;
+    if(!w || !w->current_owner || w->current_owner->kind!=surface_owner::FRAME) {
+        return;
+    }
+
+    const int region = w->frame_surface->hit(wl_fixed_to_int(x), wl_fixed_to_int(y));
+    if(region!=w->current_region) {
+        w->current_region = region;
+        set_cursor(pointer, pointer_state.serial, region_cursor(w), window_scale(w), false);
+        w->hovered_button = (region>=0) ? w->frame_surface->regions[region].button : -1;
+        update_decoration_state(w);
+        mark_input(w);
+    }
+}
+
+static void pointer_button (void *data, struct wl_pointer *pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state) {
+//    std::cout << "pointer button " << button << ", state " << state << std::endl;
+
+    window *w = pointer_state.focus;
+    if(!w) {
+        return;
+    }
+    w->button_pressed = (button==BTN_LEFT) && (state==WL_POINTER_BUTTON_STATE_PRESSED);
+
+    if(w->button_pressed && w->current_owner) {
+        // map the element under the pointer to a decoration edge or button
+        int edge = -1;
+        int function = -1;
+        switch(w->current_owner->kind) {
+        case surface_owner::FRAME:
+            if(w->current_region>=0) {
+                const frame::region &reg = w->frame_surface->regions[w->current_region];
+                edge = (reg.button<0) ? reg.edge : -1;
+                function = reg.button;
+            }
+            break;
+        case surface_owner::DECORATION:
+            edge = static_cast<const decoration*>(w->current_owner)->function;
+            break;
+        case surface_owner::BUTTON:
+            function = static_cast<const struct button*>(w->current_owner)->function;
+            break;
+        case surface_owner::CONTENT:
+            break;
+        }
+
+        if(edge!=XDG_TOPLEVEL_RESIZE_EDGE_NONE && (w->state.maximised || w->state.tiled)) {
+            // the size is given by the compositor
+            edge = -1;
+        }
+
+        if(edge>=0) {
+            switch(edge) {
+            case XDG_TOPLEVEL_RESIZE_EDGE_NONE:
+                if(w->xdg_toplevel) {
+                    xdg_toplevel_move(w->xdg_toplevel, seat, serial);
+                }
+                break;
+            default:
+                if(w->xdg_toplevel) {
+                    xdg_toplevel_resize(w->xdg_toplevel, seat, serial, edge);
+                }
+                break;
+            }
+        }
+
+        switch (function) {
+        case button::type::CLOSE:
+            w->closed = true;
+            break;
+        case button::type::MAXIMISE:
+            toggle_maximise(w);
+            break;
+        case button::type::MINIMISE:
+            if(w->xdg_toplevel) {
+                xdg_toplevel_set_minimized(w->xdg_toplevel);
+            }
+            break;
+        }
+    }
+
+    update_decoration_state(w);
+    mark_input(w);
+}
+
+static void pointer_axis (void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis, wl_fixed_t value) {
+}
+
+static struct wl_pointer_listener pointer_listener = {&pointer_enter, &pointer_leave, &pointer_motion, &pointer_button, &pointer_axis};
+
+static void seat_capabilities (void *data, struct wl_seat *seat, uint32_t capabilities) {
+    if (capabilities & WL_SEAT_CAPABILITY_POINTER) {
+        struct wl_pointer *pointer = wl_seat_get_pointer (seat);
+        wl_pointer_add_listener (pointer, &pointer_listener, data);
+        cursor_surface = wl_compositor_create_surface(compositor);
+    }
+//    if (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) {
+//        struct wl_keyboard *keyboard = wl_seat_get_keyboard (seat);
+//        wl_keyboard_add_listener (keyboard, &keyboard_listener, NULL);
+//    }
+}
+static struct wl_seat_listener seat_listener = {&seat_capabilities};
+
+static void output_geometry(void *data, struct wl_output *wl_output, int32_t x, int32_t y, int32_t physical_width, int32_t physical_height,
+                            int32_t subpixel, const char *make, const char *model, int32_t transform) {
+}
+
+static void output_mode(void *data, struct wl_output *wl_output, uint32_t flags, int32_t width, int32_t height, int32_t refresh) {
+}
+
+static void output_done(void *data, struct wl_output *wl_output) {
+}
+
+static void output_scale(void *data, struct wl_output *wl_output, int32_t factor) {
+    static_cast<output*>(data)->scale = factor;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+};
+
+static void surface_enter(void *data, struct wl_surface *surface, struct wl_output *wl_output) {
+    if(!wl_output) {
+        return;     // already destroyed
+    }
+    window *w = static_cast<const surface_owner*>(data)->window;
+    w->outputs.push_back(static_cast<const output*>(wl_output_get_user_data(wl_output)));
+}
+
+static void surface_leave(void *data, struct wl_surface *surface, struct wl_output *wl_output) {
+    if(!wl_output) {
+        return;     // already destroyed
+    }
+    window *w = static_cast<const surface_owner*>(data)->window;
+    const output *o = static_cast<const output*>(wl_output_get_user_data(wl_output));
+    w->outputs.erase(std::remove(w->outputs.begin(), w->outputs.end(), o), w->outputs.end());
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = surface_enter,
+    .leave = surface_leave,
+};
+
+static void presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id) {
+    presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_clock_id,
+};
+
+static void registry_add_object (void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
+    if (!strcmp(interface,"wl_compositor")) {
+        compositor = static_cast<wl_compositor*>(wl_registry_bind (registry, name, &wl_compositor_interface, MIN(version, 4)));
+    }
+    else if (strcmp(interface, "wl_subcompositor") == 0) {
+        subcompositor = static_cast<wl_subcompositor*>(wl_registry_bind(registry, name, &wl_subcompositor_interface, 1));
+    }
+    else if (!strcmp(interface,"wl_seat")) {
+        seat = static_cast<wl_seat*>(wl_registry_bind (registry, name, &wl_seat_interface, 1));
+        wl_seat_add_listener (seat, &seat_listener, NULL);
+    }
+    else if (strcmp(interface, "wl_shm") == 0) {
+        shm = static_cast<wl_shm*>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+    }
+    else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+        // the suspended state tells when the window is not visible
+        const uint32_t xdg_version = XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION;
+#else
+        const uint32_t xdg_version = 2;
+#endif
+        xdg_wm_base = static_cast<struct xdg_wm_base*>(wl_registry_bind(registry, name, &xdg_wm_base_interface, MIN(version, xdg_version)));
+        xdg_wm_base_add_listener(xdg_wm_base, &xdg_wm_base_listener, NULL);
+    }
+    else if (strcmp(interface, wl_output_interface.name) == 0) {
+        outputs.emplace_back(new output);
+        outputs.back()->name = name;
+        outputs.back()->output = static_cast<struct wl_output*>(wl_registry_bind(registry, name, &wl_output_interface, MIN(version, 2)));
+        wl_output_add_listener(outputs.back()->output, &output_listener, outputs.back().get());
+    }
+    else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        presentation = static_cast<struct wp_presentation*>(wl_registry_bind(registry, name, &wp_presentation_interface, 1));
+        wp_presentation_add_listener(presentation, &presentation_listener, NULL);
+    }
+    else if (strcmp(interface, zxdg_decoration_manager_v1_interface.name) == 0) {
+        decoration_manager = static_cast<struct zxdg_decoration_manager_v1*>(wl_registry_bind(registry, name, &zxdg_decoration_manager_v1_interface, 1));
+    }
+    else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        viewporter = static_cast<struct wp_viewporter*>(wl_registry_bind(registry, name, &wp_viewporter_interface, 1));
+    }
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+    else if (strcmp(interface, wp_single_pixel_buffer_manager_v1_interface.name) == 0) {
+        single_pixel_buffer_manager = static_cast<struct wp_single_pixel_buffer_manager_v1*>(wl_registry_bind(registry, name, &wp_single_pixel_buffer_manager_v1_interface, 1));
+    }
+#endif
+}
+
+static void registry_remove_object (void *data, struct wl_registry *registry, uint32_t name) {
+    for(const auto &o : outputs) {
+        if(o->output && o->name==name) {
+            // kept, windows may still reference it until their leave event
+            wl_output_destroy(o->output);
+            o->output = NULL;
+            o->scale = 1;
+        }
+    }
+}
+
+static struct wl_registry_listener registry_listener = {&registry_add_object, &registry_remove_object};
+
+static void shell_surface_ping (void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
+    wl_shell_surface_pong (shell_surface, serial);
+}
+
+static void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height) {
+    struct window *window = static_cast<struct window*>(data);
+//    std::cout << "config " << edges << " " << width << " " << height << std::endl;
+    request_resize(window, width, height, true);
+}
+
+static void shell_surface_popup_done (void *data, struct wl_shell_surface *shell_surface) {
+
+}
+
+static struct wl_shell_surface_listener shell_surface_listener = {&shell_surface_ping, &shell_surface_configure, &shell_surface_popup_done};
+
+
+// content rendering on a separate thread: the main thread dispatches input and
+// shell events and draws the decorations, content updates are handed over
+// through a lock-free queue and drawn with their own EGL context and event queue
+static bool use_render_thread = false;
+static int content_delay = 0;       // ms, simulates an expensive content draw
+
+struct render_command {
+    enum {
+        ADD, DRAW, ACK, REMOVE, QUIT
+    } type;
+    struct window *window;
+    int width, height;
+    bool ack;                       // DRAW: acknowledge 'serial' with the content commit
+    uint32_t serial;
+    std::promise<void> *done;       // REMOVE: set once the content surface is released
+    bool paint;                     // DRAW: draw the content, otherwise only commit for the ack and the frame callback
+};
+
+static void destroy_surface_wrapper(struct wl_surface *surface) {
+    wl_proxy_wrapper_destroy(surface);
+}
+
+// content surface of a window, only accessed by the render thread
+struct content_target {
+    struct window *window = NULL;
+    wl_handle<struct wl_surface, destroy_surface_wrapper> surface;  // wrapper that dispatches to the render queue
+    wl_handle<struct wl_egl_window, wl_egl_window_destroy> egl_window;
+    egl_surface_handle egl_surface;
+    int width, height;
+    int pending_width, pending_height;
+    bool dirty = false;             // needs a commit
+    bool paint = false;             // the commit has new content
+    bool ack = false;
+    uint32_t serial = 0;
+    wl_handle<struct wl_callback, wl_callback_destroy> frame_callback;
+};
+
+static struct {
+    std::thread thread;
+    spsc_queue<render_command, 1024> commands;
+    int wake_fd = -1;               // eventfd, signalled after every command
+    int done_fd = -1;               // eventfd, wakes the main thread when a content frame callback arrived
+    struct wl_event_queue *queue = NULL;
+    struct wp_presentation *presentation = NULL;                // wrapper that dispatches to the render queue
+    struct wp_presentation_feedback *first_feedback = NULL;     // of the first content frame
+} render;
+
+static void paint_content() {
+    TRACE_SCOPE("paint", "content");
+    if(content_delay>0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(content_delay));
+    }
+    glClearColor(0.0, 1.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static void render_push(const render_command &command) {
+    while(!render.commands.push(command)) {
+        // the render thread drains the queue before every frame
+        std::this_thread::yield();
+    }
+    const uint64_t one = 1;
+    if(write(render.wake_fd, &one, sizeof(one))!=sizeof(one)) {
+        std::cerr << "cannot wake render thread" << std::endl;
+    }
+}
+
+static void content_frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    content_target *target = static_cast<content_target*>(data);
+    target->frame_callback.reset();
+    // the main thread may draw the next frame of the window
+    target->window->content_pending = false;
+    const uint64_t one = 1;
+    if(write(render.done_fd, &one, sizeof(one))!=sizeof(one)) {
+        std::cerr << "cannot wake main thread" << std::endl;
+    }
+}
+
+static const struct wl_callback_listener content_frame_listener = {
+    .done = content_frame_done,
+};
+
+// the render thread only requests feedback for the time to the first frame
+static void first_feedback_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                                     uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+    stamp_first_presentation(((uint64_t(tv_sec_hi)<<32) | tv_sec_lo)*1000000000 + tv_nsec);
+    wp_presentation_feedback_destroy(feedback);
+    render.first_feedback = NULL;
+}
+
+static void first_feedback_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    // requested again with the next content frame
+    wp_presentation_feedback_destroy(feedback);
+    render.first_feedback = NULL;
+}
+
+static const struct wp_presentation_feedback_listener first_feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = first_feedback_presented,
+    .discarded = first_feedback_discarded,
+};
+
+static void render_content(struct window *window, content_target &target) {
+    TRACE_SCOPE("render_content");
+    target.dirty = false;
+    if(target.pending_width!=target.width || target.pending_height!=target.height) {
+        target.width = target.pending_width;
+        target.height = target.pending_height;
+        wl_egl_window_resize(target.egl_window, target.width, target.height, 0, 0);
+    }
+    if(target.paint) {
+        make_current(target.egl_surface, window->content_context, "content");
+        paint_content();
+    }
+    target.frame_callback = wl_surface_frame(target.surface);
+    wl_callback_add_listener(target.frame_callback, &content_frame_listener, &target);
+    if(target.ack) {
+        // applied by the following commit together with the content of the new size
+        target.ack = false;
+        xdg_surface_ack_configure(window->xdg_surface, target.serial);
+    }
+    if(render.presentation && !first_presentation && !render.first_feedback) {
+        render.first_feedback = wp_presentation_feedback(render.presentation, target.surface);
+        wp_presentation_feedback_add_listener(render.first_feedback, &first_feedback_listener, NULL);
+    }
+    if(target.paint) {
+        target.paint = false;
+        swap_buffers(target.egl_surface, target.height, {0, 0, target.width, target.height}, "content");
+    }
+    else {
+        // applies the decoration positions and the ack
+        commit(target.surface);
+    }
+    stamp_first_commit();
+}
+
+static void render_main() {
+    // signals are handled by the main thread
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    eglBindAPI(EGL_OPENGL_API);
+
+    // by window, the targets do not move while their frame callbacks are pending
+    std::map<struct window*, content_target> targets;
+    bool quit = false;
+    bool connected = true;
+    while(!quit) {
+        render_command command;
+        while(render.commands.pop(command)) {
+            switch(command.type) {
+            case render_command::ADD: {
+                content_target &target = targets[command.window];
+                target.window = command.window;
+                target.surface = static_cast<struct wl_surface*>(wl_proxy_create_wrapper(command.window->surface));
+                wl_proxy_set_queue(reinterpret_cast<struct wl_proxy*>(target.surface.ptr), render.queue);
+                target.width = target.pending_width = command.width;
+                target.height = target.pending_height = command.height;
+                target.egl_window = wl_egl_window_create(command.window->surface, command.width, command.height);
+                target.egl_surface.reset(egl_display, create_egl_surface(command.window->egl_config, command.window->content_context, target.egl_window));
+                break;
+            }
+            case render_command::DRAW: {
+                // only the latest size is drawn and only the latest serial is acknowledged,
+                // which also acknowledges all earlier configures
+                content_target &target = targets.at(command.window);
+                target.pending_width = command.width;
+                target.pending_height = command.height;
+                target.dirty = true;
+                target.paint |= command.paint;
+                if(command.ack) {
+                    target.ack = true;
+                    target.serial = command.serial;
+                }
+                break;
+            }
+            case render_command::ACK: {
+                // hidden window: acknowledge and commit without drawing, a pending draw waits until it is shown
+                content_target &target = targets.at(command.window);
+                target.ack = false;
+                xdg_surface_ack_configure(command.window->xdg_surface, command.serial);
+                commit(target.surface);
+                break;
+            }
+            case render_command::REMOVE: {
+                make_current(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                targets.erase(command.window);
+                command.done->set_value();
+                break;
+            }
+            case render_command::QUIT:
+                quit = true;
+                break;
+            }
+        }
+        if(quit) {
+            break;
+        }
+
+        // at most one content frame per frame callback
+        for(auto &target : targets) {
+            if(target.second.dirty && !target.second.frame_callback) {
+                render_content(target.first, target.second);
+            }
+        }
+
+        // wait for frame callbacks on the render queue or for new commands
+        if(connected && wl_display_prepare_read_queue(display, render.queue)!=0) {
+            wl_display_dispatch_queue_pending(display, render.queue);
+            continue;
+        }
+        if(connected) {
+            wl_display_flush(display);
+        }
+        struct pollfd fds[2] = {{render.wake_fd, POLLIN, 0}, {wl_display_get_fd(display), POLLIN, 0}};
+        const int ret = poll(fds, connected ? 2 : 1, -1);
+        if(connected) {
+            if(ret>0 && (fds[1].revents & POLLIN)) {
+                // the connection is lost, keep serving commands until the main thread quits
+                connected = (wl_display_read_events(display)!=-1);
+            }
+            else {
+                wl_display_cancel_read(display);
+                connected = !(ret>0 && fds[1].revents);
+            }
+        }
+        if(ret>0 && (fds[0].revents & POLLIN)) {
+            uint64_t count;
+            if(read(render.wake_fd, &count, sizeof(count))!=sizeof(count)) {
+                std::cerr << "cannot read render thread wakeup" << std::endl;
+            }
+        }
+        if(connected) {
+            wl_display_dispatch_queue_pending(display, render.queue);
+        }
+    }
+
+    if(render.first_feedback) {
+        wp_presentation_feedback_destroy(render.first_feedback);
+        render.first_feedback = NULL;
+    }
+    make_current(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread();
+}
+
+static void start_render_thread() {
+    render.queue = wl_display_create_queue(display);
+    if(presentation) {
+        render.presentation = static_cast<struct wp_presentation*>(wl_proxy_create_wrapper(presentation));
+        wl_proxy_set_queue(reinterpret_cast<struct wl_proxy*>(render.presentation), render.queue);
+    }
+    render.wake_fd = eventfd(0, EFD_CLOEXEC);
+    render.done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    render.thread = std::thread(render_main);
+}
+
+static void stop_render_thread() {
+    render_command quit = {render_command::QUIT, NULL, 0, 0, false, 0, NULL};
+    render_push(quit);
+    render.thread.join();
+    if(render.presentation) {
+        wl_proxy_wrapper_destroy(render.presentation);
+        render.presentation = NULL;
+    }
+    wl_event_queue_destroy(render.queue);
+    close(render.wake_fd);
+    close(render.done_fd);
+}
+
+// evaluate the layout for the content size once and move all decoration elements
+static void resize_decorations(struct window *window) {
+    decoration_layout.evaluate(window->content_width, window->content_height, window->geometry);
+    for(auto &d : window->decorations) { d.resize(window->geometry); }
+    for(size_t i = 0; i<window->buttons.size(); i++) {
+        window->buttons[i].resize(window->geometry[layout_table::first_button+i]);
+    }
+    if(window->frame_surface) { window->frame_surface->resize(window->content_width, window->content_height, window->geometry); }
+
+    if(window->frame_surface && window->frame_surface->margin && window->xdg_surface) {
+        // the shadow is not part of the window
+        xdg_surface_set_window_geometry(window->xdg_surface, -window->border_size, -window->border_size-window->title_size,
+                                        window->content_width+2*window->border_size,
+                                        window->content_height+2*window->border_size+window->title_size);
+    }
+}
+
+// client side decoration elements of a window
+static void create_decorations(struct window *window) {
+    TRACE_SCOPE("create_decorations");
+    const EGLConfig config = window->egl_config;
+    if(single_surface) {
+        window->frame_surface.reset(new frame(compositor, subcompositor, window->surface, window->border_size, window->title_size, config, window->egl_context));
+    }
+    else {
+        // the surfaces point to the elements, so the vectors must not reallocate
+        window->decorations.reserve(sizeof(decoration_edges)/sizeof(decoration_edges[0]));
+        window->buttons.reserve(active_theme.buttons.size());
+        // subsurface
+        for(const enum xdg_toplevel_resize_edge edge : decoration_edges) {
+            const double *c = active_theme.color(edge);
+            window->decorations.emplace_back(compositor, subcompositor, window->surface, window->border_size, window->title_size, config, window->egl_context, edge, c[0], c[1], c[2], c[3]);
+        }
+
+        for(const theme_button &tb : active_theme.buttons) {
+            window->buttons.emplace_back(compositor, subcompositor, window->decorations[0].surface, config, window->egl_context, button::type(tb.function), tb.color[0], tb.color[1], tb.color[2], tb.color[3]);
+        }
+    }
+
+    // map every surface to its window and element for the input handlers,
+    // after the element vectors are filled and will not reallocate anymore
+    for(decoration &d : window->decorations) {
+        d.window = window;
+        d.kind = surface_owner::DECORATION;
+        wl_surface_set_user_data(d.surface, &d);
+    }
+    for(button &b : window->buttons) {
+        b.window = window;
+        b.kind = surface_owner::BUTTON;
+        wl_surface_set_user_data(b.surface, &b);
+    }
+    if(window->frame_surface) {
+        window->frame_surface->window = window;
+        window->frame_surface->kind = surface_owner::FRAME;
+        wl_surface_set_user_data(window->frame_surface->surface, window->frame_surface.get());
+    }
+
+    if(!window->decorations.empty()) {
+        window->decorations[0].set_title(window->title);
+    }
+    if(window->frame_surface) {
+        window->frame_surface->text.set(window->title);
+    }
+
+    // new subsurfaces start in desynchronised mode
+    window->sync_decorations = false;
+    if(window->content_width>0) {
+        resize_decorations(window);
+    }
+    window->dirty = true;
+}
+
+static void destroy_decorations(struct window *window) {
+    TRACE_SCOPE("destroy_decorations");
+    if(window->current_owner!=&window->content_owner) {
+        window->current_owner = NULL;
+    }
+    window->current_region = -1;
+    window->hovered_button = -1;
+    for(decoration &d : window->decorations) {
+        d.release_text();
+    }
+    if(window->frame_surface) {
+        window->frame_surface->release_text();
+    }
+    // no surface that is destroyed below stays current
+    make_current(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    // buttons are children of the title bar
+    window->buttons.clear();
+    window->decorations.clear();
+    if(window->frame_surface && window->frame_surface->margin && window->xdg_surface) {
+        // the geometry excluded the shadow, it is the content again
+        xdg_surface_set_window_geometry(window->xdg_surface, 0, 0, window->content_width, window->content_height);
+    }
+    window->frame_surface.reset();
+}
+
+// switch between server and client side decorations
+static void set_server_side(struct window *window, bool server_side) {
+    const bool decorated = !window->decorations.empty() || window->frame_surface;
+    window->server_side = server_side;
+    if(server_side && decorated) {
+        destroy_decorations(window);
+    }
+    else if(!server_side && !decorated) {
+        create_decorations(window);
+    }
+}
+
+// the title is laid out again only if it changed, only the title bar is redrawn
+static void set_title(struct window *window, const std::string &title) {
+    if(title==window->title) {
+        return;
+    }
+    window->title = title;
+    if(window->xdg_toplevel) {
+        xdg_toplevel_set_title(window->xdg_toplevel, title.c_str());
+    }
+    if(!window->decorations.empty() && window->decorations[0].set_title(title)) {
+        window->dirty = true;
+    }
+    if(window->frame_surface && window->frame_surface->text.set(title)) {
+        // the title bar is the first region
+        if(!window->frame_surface->regions.empty()) {
+            window->frame_surface->regions[0].dirty = true;
+        }
+        window->dirty = true;
+    }
+}
+
+// the same config for all windows, chosen once
+static EGLConfig get_egl_config() {
+    static EGLConfig config = NULL;
+    if(!config) {
+        const EGLint attributes[] = {
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            EGL_NONE};
+        EGLint num_config;
+        eglChooseConfig(egl_display, attributes, &config, 1, &num_config);
+    }
+    return config;
+}
+
+static void create_window(struct window *window, int32_t width, int32_t height) {
+    TRACE_SCOPE("create_window");
+    const uint border_size = active_theme.border_size;
+    const uint title_size = active_theme.title_size;
+    eglBindAPI (EGL_OPENGL_API);
+    const EGLConfig config = get_egl_config();
+    window->egl_context.reset(egl_display, eglCreateContext(egl_display, config, EGL_NO_CONTEXT, NULL));
+    window->egl_config = config;
+
+    window->width = width;
+    window->height = height;
+    window->border_size = border_size;
+    window->title_size = title_size;
+
+    window->surface = wl_compositor_create_surface (compositor);
+
+    if(xdg_wm_base) {
         window->xdg_surface = xdg_wm_base_get_xdg_surface(xdg_wm_base, window->surface);
         window->xdg_toplevel = xdg_surface_get_toplevel(window->xdg_surface);
         xdg_surface_add_listener(window->xdg_surface, &xdg_surface_listener, window);
         xdg_toplevel_add_listener(window->xdg_toplevel, &xdg_toplevel_listener, window);
-        xdg_wm_base_add_listener(xdg_wm_base, &xdg_wm_base_listener, window);
-        xdg_toplevel_set_title(window->xdg_toplevel, "example");
         xdg_toplevel_set_app_id(window->xdg_toplevel, "example");
     }
     else {
         std::cout << "no xdg_wm_base" << std::endl;
     }
 
-    window->egl_window = wl_egl_window_create(window->surface, width, height);
-    window->egl_surface = eglCreateWindowSurface(egl_display, config, window->egl_window, NULL);
-
-    // subsurface
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_NONE, 1,0,0,1);
-
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_LEFT, 1,1,0,1);
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_RIGHT, 1,1,0,1);
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_TOP, 1,1,0,1);
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM, 1,1,0,1);
-
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT, 0,0,1,1);
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT, 0,0,1,1);
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT, 0,0,1,1);
-    window->decorations.emplace_back(compositor, subcompositor, window->surface, border_size, title_size, config, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT, 0,0,1,1);
+    if(use_render_thread) {
+        // a context can only be current on one thread, the content gets its own
+        window->content_context.reset(egl_display, eglCreateContext(egl_display, config, window->egl_context, NULL));
+        render_command add = {render_command::ADD, window, width, height, false, 0, NULL};
+        render_push(add);
+    }
+    else {
+        window->egl_window = wl_egl_window_create(window->surface, width, height);
+        window->egl_surface.reset(egl_display, create_egl_surface(config, window->egl_context, window->egl_window));
+    }
 
-    window->buttons.emplace_back(compositor, subcompositor, window->decorations[0].surface, config, 5, 4, button::type::CLOSE, 0,0,0,1);
-    window->buttons.emplace_back(compositor, subcompositor, window->decorations[0].surface, config, 20, 4, button::type::MAXIMISE, 0.5,0.5,0.5,1);
-    window->buttons.emplace_back(compositor, subcompositor, window->decorations[0].surface, config, 35, 4, button::type::MINIMISE, 1,1,1,1);
+    // map every surface to its window and element for the input handlers
+    window->content_owner.window = window;
+    window->content_owner.kind = surface_owner::CONTENT;
+    // outputs of the main surface determine the cursor scale
+    wl_surface_add_listener(window->surface, &surface_listener, &window->content_owner);
+
+    if(decoration_manager && window->xdg_toplevel) {
+        // no decoration elements until the compositor asks for client side decorations
+        window->toplevel_decoration = zxdg_decoration_manager_v1_get_toplevel_decoration(decoration_manager, window->xdg_toplevel);
+        zxdg_toplevel_decoration_v1_add_listener(window->toplevel_decoration, &toplevel_decoration_listener, window);
+        zxdg_toplevel_decoration_v1_set_mode(window->toplevel_decoration, prefer_client_side ?
+            ZXDG_TOPLEVEL_DECORATION_V1_MODE_CLIENT_SIDE : ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
+        window->server_side = true;
+    }
+    else {
+        set_server_side(window, false);
+    }
 
+    set_title(window, "example");
     window_resize(window, width, height, false);
+
+    if(window->xdg_toplevel) {
+        // initial commit without buffer, first frame is drawn after the configure
+        wl_surface_commit(window->surface);
+    }
+    else {
+        window->configured = true;
+        window->state.activated = true;
+        window->dirty = true;
+    }
 }
 
+// Release everything that other parts refer to, the Wayland and EGL objects
+// themselves are destroyed with the window
 static void delete_window (struct window *window) {
-    eglDestroySurface (egl_display, window->egl_surface);
-    wl_egl_window_destroy (window->egl_window);
-    if(xdg_wm_base) {
-        xdg_toplevel_destroy(window->xdg_toplevel);
-        xdg_surface_destroy(window->xdg_surface);
+    make_current(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(pointer_state.focus==window) {
+        pointer_state.focus = NULL;
+    }
+    window->feedbacks.clear();
+    destroy_decorations(window);
+    if(use_render_thread) {
+        // wait until the render thread released the content surface
+        std::promise<void> done;
+        render_command remove = {render_command::REMOVE, window, 0, 0, false, 0, &done};
+        render_push(remove);
+        done.get_future().wait();
     }
-    wl_surface_destroy (window->surface);
-    eglDestroyContext (egl_display, window->egl_context);
+    release_glyph_textures(window->egl_context);
 }
 
-void window_resize(struct window *window, const int width, const int height, bool full) {
+// returns true if the size of the main surface changed
+bool window_resize(struct window *window, const int width, const int height, bool full) {
+    TRACE_SCOPE("window_resize");
 //    std::cout << "config " << width << " " << height << std::endl;
     // main surface with from full surface
     int main_w, main_h;
-    if(full) {
+    if(full && !window->server_side) {
         main_w = width-2*window->border_size;
         main_h = height-2*window->border_size-window->title_size;
 //        std::cout << "new size " << main_w << " " << main_h << std::endl;
@@ -472,51 +2018,656 @@ void window_resize(struct window *window, const int width, const int height, boo
     main_h = std::max(main_h, 50);
 
     // resize main surface
-    wl_egl_window_resize(window->egl_window, main_w, main_h, 0, 0);
+    if(main_w==window->content_width && main_h==window->content_height) {
+        return false;
+    }
+    if(!use_render_thread) {
+        wl_egl_window_resize(window->egl_window, main_w, main_h, 0, 0);
+    }
+    window->content_width = main_w;
+    window->content_height = main_h;
+    window->content_dirty = true;
+
+    resize_decorations(window);
+
+    return true;
+}
+
+static void set_decorations_sync(struct window *window, bool sync) {
+    if(window->sync_decorations==sync) {
+        return;
+    }
+    window->sync_decorations = sync;
+    // buttons are children of the title bar and follow its mode
+    for(auto &d : window->decorations) {
+        sync ? wl_subsurface_set_sync(d.subsurface) : wl_subsurface_set_desync(d.subsurface);
+    }
+    if(window->frame_surface) {
+        sync ? wl_subsurface_set_sync(window->frame_surface->subsurface) : wl_subsurface_set_desync(window->frame_surface->subsurface);
+    }
+}
+
+// scripted benchmark: idle, resize storm, maximise toggles, idle
+static bool bench_mode = false;
+static std::string bench_output;
+static bench_recorder bench;
+
+static struct {
+    enum {
+        START, IDLE, RESIZE, MAXIMISE, IDLE_END, DONE
+    } step = START;
+    std::chrono::steady_clock::time_point step_start;
+    std::chrono::steady_clock::time_point toggle_time;
+    int resizes = 0;
+    int toggles = 0;
+    bool toggle_pending = false;    // waiting for the configure of a maximise toggle
+} bench_script;
+
+static void bench_next(decltype(bench_script.step) step, const char *name) {
+    bench.end(commit_count);
+    bench_script.step = step;
+    bench_script.step_start = std::chrono::steady_clock::now();
+    if(name) {
+        bench.begin(name, commit_count);
+    }
+}
+
+// advance the benchmark script, returns the poll timeout in ms
+static int bench_tick(struct window *w) {
+    using namespace std::chrono;
+    const auto now = steady_clock::now();
+    const double elapsed = duration<double>(now-bench_script.step_start).count();
+
+    switch(bench_script.step) {
+    case bench_script.START:
+        // wait until the first frame has been shown
+        if(!w->configured || w->dirty || w->frame_callback) {
+            return 10;
+        }
+        bench_next(bench_script.IDLE, "idle");
+        return 0;
+    case bench_script.IDLE:
+        if(elapsed<2) {
+            return int(1000*(2-elapsed))+1;
+        }
+        bench_next(bench_script.RESIZE, "resize_storm");
+        return 0;
+    case bench_script.RESIZE:
+        if(elapsed>=3) {
+            bench_next(bench_script.MAXIMISE, "maximise_toggle");
+            return 0;
+        }
+        // inject sizes much faster than the frame rate
+        bench_script.resizes++;
+        request_resize(w, 200+(bench_script.resizes*7)%300, 200+(bench_script.resizes*13)%300, false);
+        return 1;
+    case bench_script.MAXIMISE:
+        if(bench_script.toggle_pending && duration<double>(now-bench_script.toggle_time).count()<1) {
+            return 100;
+        }
+        if(bench_script.toggles>=10 || elapsed>=15) {
+            bench_next(bench_script.IDLE_END, "idle_end");
+            return 0;
+        }
+        toggle_maximise(w);
+        bench_script.toggles++;
+        bench_script.toggle_pending = true;
+        bench_script.toggle_time = now;
+        return 100;
+    case bench_script.IDLE_END:
+        if(elapsed<2) {
+            return int(1000*(2-elapsed))+1;
+        }
+        bench_next(bench_script.DONE, NULL);
+        if(bench_output.empty()) {
+            bench.write_json(std::cout);
+        }
+        else {
+            std::ofstream out(bench_output);
+            bench.write_json(out);
+        }
+        running = false;
+        return 0;
+    case bench_script.DONE:
+        break;
+    }
+    return -1;
+}
 
-    // resize all decoration elements
-    for(auto &d : window->decorations) { d.resize(main_w, main_h); }
+// Everything that is not needed for the first frame is done after it was
+// committed, while the compositor composites it.
+static void first_frame_committed(struct window *window) {
+    // the cursors of unscaled outputs, others are loaded when first needed
+    get_cursor_set(1);
 }
 
 static void draw_window(struct window *window) {
-    eglMakeCurrent(egl_display, window->egl_surface, window->egl_surface, window->egl_context);
-    glClearColor(0.0, 1.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    eglSwapBuffers(egl_display, window->egl_surface);
+    TRACE_SCOPE("draw_window");
+    window->dirty = false;
+
+    if(window_idle(window)) {
+        // not visible: only acknowledge the configure, a new size and the
+        // dirty elements are applied when the window is shown again
+        window->dirty = true;
+        if(!window->configure_pending) {
+            return;
+        }
+        window->configure_pending = false;
+        if(use_render_thread) {
+            render_command ack = {render_command::ACK, window, 0, 0, false, window->configure_serial, NULL};
+            render_push(ack);
+        }
+        else {
+            // no frame callback, a hidden surface would not get it until it is shown
+            xdg_surface_ack_configure(window->xdg_surface, window->configure_serial);
+            commit(window->surface);
+        }
+        return;
+    }
+
+    const uint64_t draw_start = presentation ? presentation_now() : 0;
+
+    // the decoration mode changes before the size, which then excludes or includes the frame
+    if(window->decoration_mode_pending) {
+        window->decoration_mode_pending = false;
+        set_server_side(window, window->pending_server_side);
+    }
+
+    // apply the latest configure only, intermediate sizes are dropped
+    bool resized = false;
+    if(window->resize_pending) {
+        window->resize_pending = false;
+        resized = window_resize(window, window->pending_width, window->pending_height, window->pending_full);
+    }
+
+    // while resizing, decoration commits are cached and applied atomically with
+    // the main surface commit below, switch back once the size settled
+    set_decorations_sync(window, resized || window->state.resizing);
+
+    // with a render thread, the ack is sent right before the content commit of the new size
+    const bool ack = window->configure_pending;
+    if(window->configure_pending && !use_render_thread) {
+        xdg_surface_ack_configure(window->xdg_surface, window->configure_serial);
+    }
+    window->configure_pending = false;
+
+    // draw all changed decoration elements
+    for(decoration &d : window->decorations) { d.draw(); }
+
+    for(button &b : window->buttons) { b.draw(); }
+
+    if(window->frame_surface) { window->frame_surface->draw(); }
+
+    bool content_drawn = false;
+    if(use_render_thread) {
+        // The main surface commit, which also applies the ack and the decoration
+        // positions, is done by the render thread. The next frame is only drawn
+        // after its frame callback, so the decorations of a new size never
+        // commit while the content of the previous size is still drawn.
+        content_drawn = window->content_dirty || full_redraw || resized;
+        window->content_dirty = false;
+        window->content_pending = true;
+        render_command draw = {render_command::DRAW, window, window->content_width, window->content_height,
+                               ack, window->configure_serial, NULL, content_drawn};
+        render_push(draw);
+    }
+    else {
+        // request the next frame callback before the main surface is committed
+        window->frame_callback = wl_surface_frame(window->surface);
+        wl_callback_add_listener(window->frame_callback, &frame_listener, window);
+        request_feedback(window);
+
+        if(window->content_dirty || full_redraw) {
+            window->content_dirty = false;
+            content_drawn = true;
+            make_current(window->egl_surface, window->egl_context, "content");
+            paint_content();
+            swap_buffers(window->egl_surface, window->content_height, {0, 0, window->content_width, window->content_height}, "content");
+        }
+        else {
+            // commit for the frame callback and to apply subsurface positions and acks
+            commit(window->surface);
+        }
+        stamp_first_commit();
+
+        if(presentation) {
+            // smoothed, for the frame pacing
+            const double duration = presentation_now()-draw_start;
+            window->render_time = window->render_time ? 0.9*window->render_time + 0.1*duration : duration;
+        }
+    }
+
+    if(!window->shown) {
+        window->shown = true;
+        first_frame_committed(window);
+    }
+
+    if(bench_mode) {
+        // frames that only redrew decorations are not counted
+        if(content_drawn) { bench.frame(); }
+        if(resized) {
+            bench.latency(window->pending_since);
+            bench_script.toggle_pending = false;
+        }
+    }
+
+    if(print_stats) {
+        static auto last = std::chrono::steady_clock::now();
+        static unsigned long last_count = 0;
+        const auto now = std::chrono::steady_clock::now();
+        const double dt = std::chrono::duration<double>(now-last).count();
+        if(dt>=1) {
+            std::cout << "commits/s: " << (commit_count-last_count)/dt << std::endl;
+            // the render thread requests no feedback
+            if(presentation && !use_render_thread) {
+                presentation_stats.write(std::cout);
+                presentation_stats.reset();
+            }
+            last = now;
+            last_count = commit_count;
+        }
+    }
+}
+
+// dispatch pending events or wait up to 'timeout' ms (-1: infinite) for new ones
+static int dispatch_events(int timeout) {
+    if(wl_display_prepare_read(display)!=0) {
+        // events already queued, return to the loop after handling them
+        TRACE_SCOPE("wl_display_dispatch_pending");
+        return wl_display_dispatch_pending(display);
+    }
+    wl_display_flush(display);
+
+    // the render thread signals content frame callbacks, which are dispatched on its queue
+    struct pollfd fds[2] = {{wl_display_get_fd(display), POLLIN, 0}, {render.done_fd, POLLIN, 0}};
+    const int ret = poll(fds, use_render_thread ? 2 : 1, timeout);
+    if(ret>0 && (fds[0].revents & POLLIN)) {
+        if(wl_display_read_events(display)==-1) {
+            return -1;
+        }
+    }
+    else {
+        wl_display_cancel_read(display);
+        if(ret>0 && fds[0].revents) {
+            // hang up or error on the connection
+            return -1;
+        }
+    }
+    if(use_render_thread && ret>0 && (fds[1].revents & POLLIN)) {
+        uint64_t count;
+        if(read(render.done_fd, &count, sizeof(count))!=sizeof(count)) {
+            std::cerr << "cannot read render thread signal" << std::endl;
+        }
+    }
+    TRACE_SCOPE("wl_display_dispatch_pending");
+    return wl_display_dispatch_pending(display);
+}
+
+// tracing, dumped on exit and on SIGUSR1
+std::atomic<bool> trace_enabled{false};
+std::atomic<trace_ring *> trace_rings{nullptr};
+static std::string trace_output;
+static volatile sig_atomic_t trace_dump_requested = 0;
+
+static void trace_dump() {
+    std::ofstream out(trace_output);
+    trace_write_json(out);
+    std::cout << "trace written to " << trace_output << std::endl;
+}
+
+static void handle_sigusr1(int) {
+    trace_dump_requested = 1;
+}
 
-    // draw all decoration elements
-    for(const decoration &d : window->decorations) { d.draw(); }
+// protocol request budgets against the mock compositor
+static bool use_mock_compositor = false;
+static long budget_frame = -1;      // requests per redraw without resize
+static long budget_resize = -1;     // requests per resize
 
-    for(const button &b : window->buttons) { b.draw(); }
+// draw and dispatch until the window is idle
+static bool run_until_idle(struct window *w) {
+    for(int i = 0; i<1000; i++) {
+        if(w->configured && w->dirty && !w->frame_callback && !w->content_pending) {
+            draw_window(w);
+        }
+        if(w->configured && !w->dirty && !w->frame_callback && !w->content_pending) {
+            return true;
+        }
+        if(dispatch_events(100)==-1) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// requests the compositor received since 'before', returns the total
+static unsigned long report_requests(const char *name, const std::map<std::string, unsigned long> &before,
+                                     const std::map<std::string, unsigned long> &after) {
+    unsigned long total = 0;
+    std::cout << name << ":";
+    for(const auto &count : after) {
+        const unsigned long n = count.second - (before.count(count.first) ? before.at(count.first) : 0);
+        if(n) {
+            std::cout << " " << count.first << "=" << n;
+            total += n;
+        }
+    }
+    std::cout << " (total " << total << ")" << std::endl;
+    return total;
+}
+
+// count the requests of a redraw and of resizes, returns false if a budget is exceeded
+static bool run_protocol_budget(struct window *w, mock_compositor &mock) {
+    if(!run_until_idle(w)) {
+        return false;
+    }
+    wl_display_roundtrip(display);
+
+    // redraw caused by a hovered button
+    auto before = mock.request_counts();
+    w->hovered_button = button::type::CLOSE;
+    update_decoration_state(w);
+    run_until_idle(w);
+    wl_display_roundtrip(display);
+    auto after = mock.request_counts();
+    const unsigned long frame_requests = report_requests("frame", before, after);
+
+    // worst case of several resizes
+    unsigned long resize_requests = 0;
+    for(int i = 0; i<10; i++) {
+        before = mock.request_counts();
+        mock.configure(300+10*i, 200+20*i);
+        wl_display_roundtrip(display);
+        run_until_idle(w);
+        wl_display_roundtrip(display);
+        after = mock.request_counts();
+        resize_requests = std::max(resize_requests, report_requests("resize", before, after));
+    }
+
+    bool ok = true;
+    if(budget_frame>=0 && frame_requests>(unsigned long)budget_frame) {
+        std::cerr << "frame requests " << frame_requests << " exceed budget " << budget_frame << std::endl;
+        ok = false;
+    }
+    if(budget_resize>=0 && resize_requests>(unsigned long)budget_resize) {
+        std::cerr << "resize requests " << resize_requests << " exceed budget " << budget_resize << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+// --stress: open, draw and close windows one after another, the resident
+// memory and the number of open file descriptors have to stay flat
+static int stress_cycles = 0;
+static const long stress_rss_slack = 4096;      // KiB, allocator and driver caches
+
+static long resident_kib() {
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident*(sysconf(_SC_PAGESIZE)/1024);
+}
+
+static int open_fds() {
+    int count = 0;
+    if(DIR *dir = opendir("/proc/self/fd")) {
+        while(struct dirent *entry = readdir(dir)) {
+            if(entry->d_name[0]!='.') { count++; }
+        }
+        closedir(dir);
+    }
+    return count-1;     // the directory itself
+}
+
+static bool run_stress(const int cycles) {
+    // the first cycles fill caches (cursor themes, glyph atlases, the shm pool)
+    const int warmup = std::max(1, cycles/10);
+    long rss_start = 0;
+    int fds_start = 0;
+    for(int i = 0; i<cycles; i++) {
+        if(i==warmup) {
+            rss_start = resident_kib();
+            fds_start = open_fds();
+        }
+        std::unique_ptr<struct window> w(new struct window);
+        create_window(w.get(), 256, 256);
+        if(!run_until_idle(w.get())) {
+            std::cerr << "stress: window " << i << " did not draw" << std::endl;
+            return false;
+        }
+        delete_window(w.get());
+        w.reset();
+        // let the compositor release the buffers of the destroyed surfaces
+        wl_display_roundtrip(display);
+    }
+    const long rss_end = resident_kib();
+    const int fds_end = open_fds();
+    std::cout << "stress: " << cycles << " windows, RSS " << rss_start << " -> " << rss_end << " KiB, fds "
+              << fds_start << " -> " << fds_end << std::endl;
+    return fds_end<=fds_start && rss_end<=rss_start+stress_rss_slack;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     std::cout << "Hello World!" << std::endl;
 
-    struct window window;
+    int window_count = 1;
+
+    for(int i = 1; i<argc; i++) {
+        if(!strcmp(argv[i], "--always-make-current")) {
+            skip_make_current = false;
+        }
+        else if(!strcmp(argv[i], "--no-viewporter")) {
+            use_viewporter = false;
+        }
+        else if(!strcmp(argv[i], "--single-surface")) {
+            single_surface = true;
+        }
+        else if(!strcmp(argv[i], "--software-decorations")) {
+            software_decorations = true;
+        }
+        else if(!strcmp(argv[i], "--theme") && i+1<argc) {
+            active_theme.load(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--full-redraw")) {
+            full_redraw = true;
+        }
+        else if(!strcmp(argv[i], "--stats")) {
+            print_stats = true;
+        }
+        else if(!strcmp(argv[i], "--bench")) {
+            bench_mode = true;
+        }
+        else if(!strcmp(argv[i], "--bench-output") && i+1<argc) {
+            bench_output = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--trace") && i+1<argc) {
+            trace_output = argv[++i];
+            trace_enabled = true;
+        }
+        else if(!strcmp(argv[i], "--mock-compositor")) {
+            use_mock_compositor = true;
+        }
+        else if(!strcmp(argv[i], "--budget-frame") && i+1<argc) {
+            budget_frame = atol(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--budget-resize") && i+1<argc) {
+            budget_resize = atol(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--prefer-client-side")) {
+            prefer_client_side = true;
+        }
+        else if(!strcmp(argv[i], "--pacing")) {
+            pacing = true;
+        }
+        else if(!strcmp(argv[i], "--render-thread")) {
+            use_render_thread = true;
+        }
+        else if(!strcmp(argv[i], "--content-delay") && i+1<argc) {
+            content_delay = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--stress") && i+1<argc) {
+            stress_cycles = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--windows") && i+1<argc) {
+            window_count = std::max(1, atoi(argv[++i]));
+        }
+    }
+
+    // frame timings and presentation feedback are taken around the content commit on the main thread
+    if(use_render_thread && (pacing || bench_mode)) {
+        std::cerr << "--pacing and --bench cannot be combined with --render-thread" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    decoration_layout.compile(active_theme);
+
+    if(trace_enabled) {
+        // no SA_RESTART, so that the signal interrupts poll() in the main loop
+        struct sigaction action = {};
+        action.sa_handler = handle_sigusr1;
+        sigaction(SIGUSR1, &action, NULL);
+    }
 
-    display = wl_display_connect(NULL);
+    mock_compositor mock;
+    if(use_mock_compositor) {
+        // the mock has no GPU buffer sharing, render to wl_shm
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+        display = wl_display_connect_to_fd(mock.start());
+    }
+    else {
+        display = wl_display_connect(NULL);
+    }
     if(!display) {
         std::cerr << "cannot connect to Wayland server" << std::endl;
         return EXIT_FAILURE;
     }
     struct wl_registry *registry = wl_display_get_registry(display);
-    wl_registry_add_listener(registry, &registry_listener, &window);
+    wl_registry_add_listener(registry, &registry_listener, NULL);
     wl_display_roundtrip(display);
 
+    // solid decorations need a viewport and a 1x1 buffer, otherwise use EGL
+    use_viewporter = use_viewporter && viewporter && shm;
+    std::cout << "decoration backend: " << (use_viewporter ? "viewporter" : "EGL") << std::endl;
+    // software decorations replace the EGL surfaces of the decorations
+    // also holds the title labels of solid title bars
+    const bool pool_ready = shm && (software_decorations || use_viewporter) && decoration_pool.init(shm, software_decorations ? 1<<20 : 1<<16);
+    software_decorations = software_decorations && pool_ready;
+    if(software_decorations) {
+        std::cout << "software decorations: " << get_span_kernels().name << std::endl;
+    }
+
     egl_display = eglGetDisplay (display);
     eglInitialize(egl_display, NULL, NULL);
 
-    create_window(&window, 256, 256);
+    const char *egl_extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+    if(egl_extensions && strstr(egl_extensions, "EGL_KHR_swap_buffers_with_damage")) {
+        swap_buffers_with_damage = reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(eglGetProcAddress("eglSwapBuffersWithDamageKHR"));
+    }
+    else if(egl_extensions && strstr(egl_extensions, "EGL_EXT_swap_buffers_with_damage")) {
+        swap_buffers_with_damage = reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(eglGetProcAddress("eglSwapBuffersWithDamageEXT"));
+    }
+
+    if(use_render_thread && use_mock_compositor) {
+        // the protocol budget counts the requests of the single threaded path
+        std::cout << "--render-thread is ignored with --mock-compositor" << std::endl;
+        use_render_thread = false;
+    }
+    if(use_render_thread) {
+        start_render_thread();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // windows are not moved, their surfaces point to them
+    std::vector<std::unique_ptr<struct window>> windows;
+    int ret = 0;
+    if(stress_cycles>0) {
+        ret = run_stress(stress_cycles) ? 0 : EXIT_FAILURE;
+        running = false;
+    }
+    else {
+        windows.reserve(window_count);
+        for(int i = 0; i<window_count; i++) {
+            windows.emplace_back(new struct window);
+            create_window(windows.back().get(), 256, 256);
+        }
+    }
+
+    if(use_mock_compositor && !windows.empty()) {
+        ret = run_protocol_budget(windows[0].get(), mock) ? 0 : EXIT_FAILURE;
+        running = false;
+    }
+
+    while (running && !windows.empty()) {
+        // redraw at most once per compositor frame and only if something changed
+        int timeout = -1;
+        for(const auto &window : windows) {
+            if (window_idle(window.get()) && window->configure_pending) {
+                // acknowledged right away, frame callbacks do not arrive while hidden
+                draw_window (window.get());
+            }
+            else if (window->configured && window->dirty && !window->frame_callback && !window->content_pending &&
+                     !window_idle(window.get())) {
+                // with pacing, wait and collect more input until shortly before the next refresh
+                const int delay = pacing ? paced_delay(window.get()) : 0;
+                if (delay>0) {
+                    timeout = (timeout<0) ? delay : std::min(timeout, delay);
+                }
+                else {
+                    draw_window (window.get());
+                }
+            }
+        }
+        if (bench_mode) {
+            const int bench_timeout = bench_tick(windows[0].get());
+            if (bench_timeout>=0) {
+                timeout = (timeout<0) ? bench_timeout : std::min(timeout, bench_timeout);
+            }
+        }
+        if (!running) {
+            break;
+        }
+        // block until the next event (configure, input, frame callback)
+        if (dispatch_events (timeout) == -1) {
+            break;
+        }
+        // windows closed by the compositor or the close button
+        for(auto it = windows.begin(); it!=windows.end();) {
+            if((*it)->closed) {
+                delete_window(it->get());
+                it = windows.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if (trace_dump_requested) {
+            trace_dump_requested = 0;
+            trace_dump();
+        }
+    }
+
+    const double runtime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    std::cout << "commits: " << commit_count << " (" << commit_count/runtime << "/s)" << std::endl;
+    if(presentation && !print_stats) {
+        presentation_stats.write(std::cout);
+    }
 
-    while (running) {
-        wl_display_dispatch_pending (display);
-        draw_window (&window);
+    if(trace_enabled) {
+        trace_dump();
     }
 
-    delete_window (&window);
+    for(const auto &window : windows) {
+        delete_window (window.get());
+    }
+    windows.clear();
+    if(use_render_thread) {
+        stop_render_thread();
+    }
+    decoration_pool.destroy();
     eglTerminate (egl_display);
     wl_display_disconnect (display);
+    mock.stop();
 
-    return 0;
+    return ret;
 }
@@ -0,0 +1,418 @@
+#include "mock_compositor.hpp"
+
+#include <wayland-server.h>
+#include <wayland-xdg-shell-server-protocol.h>
+#include <wayland-viewporter-server-protocol.h>
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+#include <wayland-single-pixel-buffer-v1-server-protocol.h>
+#endif
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// size of the fake output, used for maximised toplevels
+static const int output_width = 1024;
+static const int output_height = 640;
+
+struct mock_compositor::impl {
+    struct wl_display *display = NULL;
+    struct wl_protocol_logger *logger = NULL;
+    struct wl_event_source *command_source = NULL;
+    int command_fd = -1;
+    std::thread thread;
+
+    // commands executed on the server thread
+    std::mutex mutex;
+    std::condition_variable done;
+    std::vector<std::function<void()>> commands;
+    unsigned long queued = 0;
+    unsigned long executed = 0;
+
+    std::map<std::string, unsigned long> counts;    // guarded by 'mutex'
+
+    std::vector<struct wl_resource *> toplevels;    // server thread only
+};
+
+// per wl_surface state
+struct mock_surface {
+    mock_compositor::impl *mock;
+    struct wl_resource *buffer = NULL;      // attached, not committed
+    std::vector<struct wl_resource *> frame_callbacks;
+    struct wl_resource *xdg_surface = NULL;
+    struct wl_resource *xdg_toplevel = NULL;
+    bool configured = false;
+};
+
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static void send_configure(mock_surface *surface, int width, int height, bool maximised) {
+    if(!surface->xdg_toplevel || !surface->xdg_surface) {
+        return;
+    }
+    struct wl_array states;
+    wl_array_init(&states);
+    uint32_t *state = static_cast<uint32_t*>(wl_array_add(&states, sizeof(uint32_t)));
+    *state = XDG_TOPLEVEL_STATE_ACTIVATED;
+    if(maximised) {
+        state = static_cast<uint32_t*>(wl_array_add(&states, sizeof(uint32_t)));
+        *state = XDG_TOPLEVEL_STATE_MAXIMIZED;
+    }
+    xdg_toplevel_send_configure(surface->xdg_toplevel, width, height, &states);
+    xdg_surface_send_configure(surface->xdg_surface, wl_display_next_serial(surface->mock->display));
+    wl_array_release(&states);
+}
+
+// buffers
+
+static const struct wl_buffer_interface buffer_impl = {
+    destroy_resource,
+};
+
+// surfaces
+
+static void remove_toplevel(mock_compositor::impl *mock, struct wl_resource *toplevel) {
+    for(auto it = mock->toplevels.begin(); it!=mock->toplevels.end(); ++it) {
+        if(*it==toplevel) {
+            mock->toplevels.erase(it);
+            break;
+        }
+    }
+}
+
+static void surface_resource_destroy(struct wl_resource *resource) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    // role objects may outlive the surface, e.g. on client disconnect
+    if(surface->xdg_toplevel) {
+        remove_toplevel(surface->mock, surface->xdg_toplevel);
+        wl_resource_set_user_data(surface->xdg_toplevel, NULL);
+    }
+    if(surface->xdg_surface) {
+        wl_resource_set_user_data(surface->xdg_surface, NULL);
+    }
+    delete surface;
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *resource, struct wl_resource *buffer, int32_t x, int32_t y) {
+    static_cast<mock_surface*>(wl_resource_get_user_data(resource))->buffer = buffer;
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    surface->frame_callbacks.push_back(wl_resource_create(client, &wl_callback_interface, 1, callback));
+}
+
+static void surface_commit(struct wl_client *client, struct wl_resource *resource) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    // nothing is composited, release buffers and signal frames immediately
+    if(surface->buffer) {
+        wl_buffer_send_release(surface->buffer);
+        surface->buffer = NULL;
+    }
+    for(struct wl_resource *callback : surface->frame_callbacks) {
+        wl_callback_send_done(callback, 0);
+        wl_resource_destroy(callback);
+    }
+    surface->frame_callbacks.clear();
+
+    // initial commit of a toplevel
+    if(surface->xdg_toplevel && surface->xdg_surface && !surface->configured) {
+        surface->configured = true;
+        send_configure(surface, 0, 0, false);
+    }
+}
+
+static const struct wl_surface_interface surface_impl = {
+    destroy_resource,
+    surface_attach,
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t, int32_t, int32_t) {},     // damage
+    surface_frame,
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*) {},                    // set_opaque_region
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*) {},                    // set_input_region
+    surface_commit,
+    [](struct wl_client*, struct wl_resource*, int32_t) {},                                // set_buffer_transform
+    [](struct wl_client*, struct wl_resource*, int32_t) {},                                // set_buffer_scale
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t, int32_t, int32_t) {},     // damage_buffer
+};
+
+static const struct wl_region_interface region_impl = {
+    destroy_resource,
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t, int32_t, int32_t) {},     // add
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t, int32_t, int32_t) {},     // subtract
+};
+
+static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct wl_resource *surface = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(resource), id);
+    mock_surface *state = new mock_surface;
+    state->mock = static_cast<mock_compositor::impl*>(wl_resource_get_user_data(resource));
+    wl_resource_set_implementation(surface, &surface_impl, state, surface_resource_destroy);
+}
+
+static void compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct wl_resource *region = wl_resource_create(client, &wl_region_interface, 1, id);
+    wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+    compositor_create_surface,
+    compositor_create_region,
+};
+
+// subsurfaces
+
+static const struct wl_subsurface_interface subsurface_impl = {
+    destroy_resource,
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t) {},                       // set_position
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*) {},                    // place_above
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*) {},                    // place_below
+    [](struct wl_client*, struct wl_resource*) {},                                         // set_sync
+    [](struct wl_client*, struct wl_resource*) {},                                         // set_desync
+};
+
+static void subcompositor_get_subsurface(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+                                         struct wl_resource *surface, struct wl_resource *parent) {
+    struct wl_resource *subsurface = wl_resource_create(client, &wl_subsurface_interface, 1, id);
+    wl_resource_set_implementation(subsurface, &subsurface_impl, NULL, NULL);
+}
+
+static const struct wl_subcompositor_interface subcompositor_impl = {
+    destroy_resource,
+    subcompositor_get_subsurface,
+};
+
+// seat without any input devices
+
+static const struct wl_seat_interface seat_impl = {
+    [](struct wl_client*, struct wl_resource*, uint32_t) {},                               // get_pointer
+    [](struct wl_client*, struct wl_resource*, uint32_t) {},                               // get_keyboard
+    [](struct wl_client*, struct wl_resource*, uint32_t) {},                               // get_touch
+    destroy_resource,                                                                      // release
+};
+
+// xdg shell
+
+static void toplevel_resource_destroy(struct wl_resource *resource) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    if(surface) {
+        remove_toplevel(surface->mock, resource);
+        surface->xdg_toplevel = NULL;
+    }
+}
+
+static void toplevel_set_maximized(struct wl_client *client, struct wl_resource *resource) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    if(surface) {
+        send_configure(surface, output_width, output_height, true);
+    }
+}
+
+static void toplevel_unset_maximized(struct wl_client *client, struct wl_resource *resource) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    if(surface) {
+        send_configure(surface, 0, 0, false);
+    }
+}
+
+static const struct xdg_toplevel_interface toplevel_impl = {
+    destroy_resource,
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*) {},                    // set_parent
+    [](struct wl_client*, struct wl_resource*, const char*) {},                            // set_title
+    [](struct wl_client*, struct wl_resource*, const char*) {},                            // set_app_id
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*, uint32_t, int32_t, int32_t) {},    // show_window_menu
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*, uint32_t) {},          // move
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*, uint32_t, uint32_t) {},    // resize
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t) {},                       // set_max_size
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t) {},                       // set_min_size
+    toplevel_set_maximized,
+    toplevel_unset_maximized,
+    [](struct wl_client*, struct wl_resource*, struct wl_resource*) {},                    // set_fullscreen
+    [](struct wl_client*, struct wl_resource*) {},                                         // unset_fullscreen
+    [](struct wl_client*, struct wl_resource*) {},                                         // set_minimized
+};
+
+static void xdg_surface_get_toplevel(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    struct wl_resource *toplevel = wl_resource_create(client, &xdg_toplevel_interface, wl_resource_get_version(resource), id);
+    wl_resource_set_implementation(toplevel, &toplevel_impl, surface, toplevel_resource_destroy);
+    if(surface) {
+        surface->xdg_toplevel = toplevel;
+        surface->mock->toplevels.push_back(toplevel);
+    }
+}
+
+static const struct xdg_surface_interface xdg_surface_impl = {
+    destroy_resource,
+    xdg_surface_get_toplevel,
+    [](struct wl_client*, struct wl_resource*, uint32_t, struct wl_resource*, struct wl_resource*) {},  // get_popup
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t, int32_t, int32_t) {},     // set_window_geometry
+    [](struct wl_client*, struct wl_resource*, uint32_t) {},                               // ack_configure
+};
+
+static void xdg_surface_resource_destroy(struct wl_resource *resource) {
+    mock_surface *surface = static_cast<mock_surface*>(wl_resource_get_user_data(resource));
+    if(surface) {
+        surface->xdg_surface = NULL;
+    }
+}
+
+static void wm_base_get_xdg_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *surface) {
+    mock_surface *state = static_cast<mock_surface*>(wl_resource_get_user_data(surface));
+    state->xdg_surface = wl_resource_create(client, &xdg_surface_interface, wl_resource_get_version(resource), id);
+    wl_resource_set_implementation(state->xdg_surface, &xdg_surface_impl, state, xdg_surface_resource_destroy);
+}
+
+static const struct xdg_wm_base_interface wm_base_impl = {
+    destroy_resource,
+    [](struct wl_client*, struct wl_resource*, uint32_t) {},                               // create_positioner
+    wm_base_get_xdg_surface,
+    [](struct wl_client*, struct wl_resource*, uint32_t) {},                               // pong
+};
+
+// viewporter
+
+static const struct wp_viewport_interface viewport_impl = {
+    destroy_resource,
+    [](struct wl_client*, struct wl_resource*, wl_fixed_t, wl_fixed_t, wl_fixed_t, wl_fixed_t) {},     // set_source
+    [](struct wl_client*, struct wl_resource*, int32_t, int32_t) {},                       // set_destination
+};
+
+static void viewporter_get_viewport(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *surface) {
+    struct wl_resource *viewport = wl_resource_create(client, &wp_viewport_interface, 1, id);
+    wl_resource_set_implementation(viewport, &viewport_impl, NULL, NULL);
+}
+
+static const struct wp_viewporter_interface viewporter_impl = {
+    destroy_resource,
+    viewporter_get_viewport,
+};
+
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+static void single_pixel_buffer_create(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+                                       uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+    struct wl_resource *buffer = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    wl_resource_set_implementation(buffer, &buffer_impl, NULL, NULL);
+}
+
+static const struct wp_single_pixel_buffer_manager_v1_interface single_pixel_buffer_impl = {
+    destroy_resource,
+    single_pixel_buffer_create,
+};
+#endif
+
+// globals
+
+template<typename T, const struct wl_interface *interface, const T *implementation>
+static void bind_global(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, interface, version, id);
+    wl_resource_set_implementation(resource, implementation, data, NULL);
+    if(interface==&wl_seat_interface) {
+        wl_seat_send_capabilities(resource, 0);
+    }
+}
+
+static void count_request(void *data, enum wl_protocol_logger_type direction, const struct wl_protocol_logger_message *message) {
+    if(direction!=WL_PROTOCOL_LOGGER_REQUEST) {
+        return;
+    }
+    mock_compositor::impl *d = static_cast<mock_compositor::impl*>(data);
+    const std::string name = std::string(wl_resource_get_class(message->resource)) + "." + message->message->name;
+    std::lock_guard<std::mutex> lock(d->mutex);
+    d->counts[name]++;
+}
+
+static int run_commands(int fd, uint32_t mask, void *data) {
+    mock_compositor::impl *d = static_cast<mock_compositor::impl*>(data);
+    uint64_t n;
+    if(read(fd, &n, sizeof(n))<0) {
+        return 0;
+    }
+    std::vector<std::function<void()>> commands;
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        commands.swap(d->commands);
+    }
+    for(const auto &command : commands) {
+        command();
+    }
+    wl_display_flush_clients(d->display);
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        d->executed += commands.size();
+    }
+    d->done.notify_all();
+    return 0;
+}
+
+int mock_compositor::start() {
+    d = new impl;
+    d->display = wl_display_create();
+    wl_display_init_shm(d->display);
+
+    wl_global_create(d->display, &wl_compositor_interface, 4, d, bind_global<struct wl_compositor_interface, &wl_compositor_interface, &compositor_impl>);
+    wl_global_create(d->display, &wl_subcompositor_interface, 1, d, bind_global<struct wl_subcompositor_interface, &wl_subcompositor_interface, &subcompositor_impl>);
+    wl_global_create(d->display, &wl_seat_interface, 1, d, bind_global<struct wl_seat_interface, &wl_seat_interface, &seat_impl>);
+    wl_global_create(d->display, &xdg_wm_base_interface, 2, d, bind_global<struct xdg_wm_base_interface, &xdg_wm_base_interface, &wm_base_impl>);
+    wl_global_create(d->display, &wp_viewporter_interface, 1, d, bind_global<struct wp_viewporter_interface, &wp_viewporter_interface, &viewporter_impl>);
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+    wl_global_create(d->display, &wp_single_pixel_buffer_manager_v1_interface, 1, d,
+                     bind_global<struct wp_single_pixel_buffer_manager_v1_interface, &wp_single_pixel_buffer_manager_v1_interface, &single_pixel_buffer_impl>);
+#endif
+
+    d->logger = wl_display_add_protocol_logger(d->display, count_request, d);
+
+    d->command_fd = eventfd(0, EFD_CLOEXEC);
+    d->command_source = wl_event_loop_add_fd(wl_display_get_event_loop(d->display), d->command_fd, WL_EVENT_READABLE, run_commands, d);
+
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)<0) {
+        std::cerr << "cannot create socket pair" << std::endl;
+        return -1;
+    }
+    wl_client_create(d->display, fds[0]);
+
+    d->thread = std::thread(wl_display_run, d->display);
+
+    return fds[1];
+}
+
+void mock_compositor::stop() {
+    if(!d) {
+        return;
+    }
+    wl_display_terminate(d->display);
+    d->thread.join();
+    wl_event_source_remove(d->command_source);
+    close(d->command_fd);
+    wl_protocol_logger_destroy(d->logger);
+    wl_display_destroy(d->display);
+    delete d;
+    d = nullptr;
+}
+
+void mock_compositor::configure(int width, int height) {
+    impl *mock = d;
+    std::unique_lock<std::mutex> lock(d->mutex);
+    d->commands.push_back([mock, width, height]() {
+        for(struct wl_resource *toplevel : mock->toplevels) {
+            send_configure(static_cast<mock_surface*>(wl_resource_get_user_data(toplevel)), width, height, false);
+        }
+    });
+    const unsigned long id = ++d->queued;
+    const uint64_t n = 1;
+    if(write(d->command_fd, &n, sizeof(n))<0) {
+        return;
+    }
+    d->done.wait(lock, [this, id]() { return d->executed>=id; });
+}
+
+std::map<std::string, unsigned long> mock_compositor::request_counts() {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    return d->counts;
+}
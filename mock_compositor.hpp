@@ -0,0 +1,23 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+// In-process Wayland server stand-in. It implements the globals the example
+// binds (wl_compositor, wl_subcompositor, wl_seat, wl_shm, xdg_wm_base and the
+// viewporter protocols) without drawing anything and counts every request it
+// receives from the client as "interface.request".
+struct mock_compositor {
+    struct impl;
+    impl *d = nullptr;
+
+    // start the server thread, returns the client end of the connection
+    int start();
+    void stop();
+
+    // send a toplevel configure with the given size to all toplevels and wait until it is sent
+    void configure(int width, int height);
+
+    // snapshot of the request counts since start
+    std::map<std::string, unsigned long> request_counts();
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "sw_render.hpp"
+
+// One memfd backed wl_shm_pool for all software drawn decorations. Buffers are
+// sub-allocated first fit and the pool grows when it runs out of space. A buffer
+// can only be drawn again after the compositor sent wl_buffer.release.
+
+struct shm_pool;
+
+struct shm_buffer {
+    struct shm_pool *pool;
+    struct wl_buffer *buffer;
+    size_t offset;
+    size_t size;
+    int width;
+    int height;
+    bool busy = false;          // attached and not yet released by the compositor
+    bool orphaned = false;      // destroyed by its owner while busy, freed on release
+
+    canvas pixels() const;
+};
+
+struct shm_pool {
+    struct wl_shm *shm = NULL;
+    struct wl_shm_pool *pool = NULL;
+    int fd = -1;
+    size_t size = 0;
+    uint8_t *data = NULL;
+    std::vector<std::pair<size_t, size_t>> free_ranges;    // offset and size, sorted by offset
+
+    bool init(struct wl_shm *_shm, const size_t initial_size) {
+        shm = _shm;
+        fd = memfd_create("decorations", MFD_CLOEXEC);
+        if(fd<0 || !grow(initial_size)) {
+            std::cerr << "cannot create shm pool" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void destroy() {
+        if(pool) { wl_shm_pool_destroy(pool); }
+        if(data) { munmap(data, size); }
+        if(fd>=0) { close(fd); }
+        *this = shm_pool();
+    }
+
+    bool grow(const size_t new_size) {
+        if(ftruncate(fd, new_size)<0) {
+            return false;
+        }
+        // the mapping moves, buffers only keep their offset
+        if(data) { munmap(data, size); }
+        data = static_cast<uint8_t*>(mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        if(data==MAP_FAILED) {
+            data = NULL;
+            return false;
+        }
+        if(pool) {
+            wl_shm_pool_resize(pool, new_size);
+        }
+        else {
+            pool = wl_shm_create_pool(shm, fd, new_size);
+        }
+        release_range(size, new_size-size);
+        size = new_size;
+        return true;
+    }
+
+    void release_range(const size_t offset, const size_t length) {
+        auto it = free_ranges.begin();
+        while(it!=free_ranges.end() && it->first<offset) { it++; }
+        it = free_ranges.insert(it, {offset, length});
+        // merge with the neighbours
+        if(it+1!=free_ranges.end() && it->first+it->second==(it+1)->first) {
+            it->second += (it+1)->second;
+            free_ranges.erase(it+1);
+        }
+        if(it!=free_ranges.begin() && (it-1)->first+(it-1)->second==it->first) {
+            (it-1)->second += it->second;
+            free_ranges.erase(it);
+        }
+    }
+
+    // returns NULL if the pool cannot grow
+    shm_buffer *create_buffer(const int width, const int height) {
+        TRACE_SCOPE("create_shm_buffer");
+        const size_t length = size_t(width)*height*sizeof(uint32_t);
+        auto fit = [&]() {
+            for(auto it = free_ranges.begin(); it!=free_ranges.end(); it++) {
+                if(it->second>=length) { return it; }
+            }
+            return free_ranges.end();
+        };
+        auto it = fit();
+        if(it==free_ranges.end()) {
+            if(!grow(std::max(2*size, size+length))) {
+                return NULL;
+            }
+            it = fit();
+        }
+        shm_buffer *b = new shm_buffer;
+        b->pool = this;
+        b->offset = it->first;
+        b->size = length;
+        b->width = width;
+        b->height = height;
+        it->first += length;
+        it->second -= length;
+        if(!it->second) { free_ranges.erase(it); }
+        b->buffer = wl_shm_pool_create_buffer(pool, b->offset, width, height, width*sizeof(uint32_t), WL_SHM_FORMAT_ARGB8888);
+        static const struct wl_buffer_listener buffer_listener = {buffer_release};
+        wl_buffer_add_listener(b->buffer, &buffer_listener, b);
+        return b;
+    }
+
+    // the buffer is freed now or, if the compositor still uses it, on release
+    static void destroy_buffer(shm_buffer *b) {
+        if(b->busy) {
+            b->orphaned = true;
+            return;
+        }
+        wl_buffer_destroy(b->buffer);
+        b->pool->release_range(b->offset, b->size);
+        delete b;
+    }
+
+    static void buffer_release(void *data, struct wl_buffer *buffer) {
+        shm_buffer *b = static_cast<shm_buffer*>(data);
+        b->busy = false;
+        if(b->orphaned) {
+            destroy_buffer(b);
+        }
+    }
+};
+
+inline canvas shm_buffer::pixels() const {
+    return {reinterpret_cast<uint32_t*>(pool->data+offset), width, height, width};
+}
+
+// The buffers of one surface. The content of the last attached buffer stays
+// valid, so if it was released in time only the damaged part is drawn again.
+struct shm_swapchain {
+    std::vector<shm_buffer*> buffers;
+    shm_buffer *last = NULL;
+
+    shm_swapchain() = default;
+    shm_swapchain(const shm_swapchain &) = delete;
+    shm_swapchain &operator=(const shm_swapchain &) = delete;
+    shm_swapchain(shm_swapchain &&other) : buffers(std::move(other.buffers)), last(other.last) {
+        other.buffers.clear();
+        other.last = NULL;
+    }
+
+    ~shm_swapchain() {
+        destroy();
+    }
+
+    // a free buffer of the size, 'valid' is set if it still has the last frame
+    shm_buffer *acquire(shm_pool &pool, const int width, const int height, bool &valid) {
+        valid = false;
+        // drop free buffers of an old size, busy ones are freed when released
+        for(auto it = buffers.begin(); it!=buffers.end();) {
+            if((*it)->width!=width || (*it)->height!=height) {
+                if(*it==last) { last = NULL; }
+                shm_pool::destroy_buffer(*it);
+                it = buffers.erase(it);
+            }
+            else {
+                it++;
+            }
+        }
+        if(last && !last->busy) {
+            valid = true;
+            return last;
+        }
+        for(shm_buffer *b : buffers) {
+            if(!b->busy) { return b; }
+        }
+        shm_buffer *b = pool.create_buffer(width, height);
+        if(b) { buffers.push_back(b); }
+        return b;
+    }
+
+    void attach(struct wl_surface *surface, shm_buffer *b) {
+        wl_surface_attach(surface, b->buffer, 0, 0);
+        b->busy = true;
+        last = b;
+    }
+
+    void destroy() {
+        for(shm_buffer *b : buffers) {
+            shm_pool::destroy_buffer(b);
+        }
+        buffers.clear();
+        last = NULL;
+    }
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded queue for exactly one producer and one consumer thread, without locks.
+// The producer only writes 'tail', the consumer only writes 'head'.
+template<typename T, size_t N>
+struct spsc_queue {
+    static_assert((N & (N-1))==0, "capacity must be a power of two");
+
+    T items[N];
+    std::atomic<size_t> head{0};    // next item to pop
+    std::atomic<size_t> tail{0};    // next free slot
+
+    // returns false if the queue is full
+    bool push(const T &item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if(t-head.load(std::memory_order_acquire)==N) {
+            return false;
+        }
+        items[t % N] = item;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    // returns false if the queue is empty
+    bool pop(T &item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if(h==tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[h % N];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+};
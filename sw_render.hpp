@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SW_RENDER_X86
+#endif
+
+#include "trace.hpp"
+
+// CPU rendering of decorations into premultiplied ARGB8888 buffers. The span
+// kernels are chosen once at runtime from scalar, SSE2 and AVX2 variants.
+// Shadows and rounded corners are drawn from tiles that are computed once per
+// (shadow, radius, scale), a resize only repeats the edge pixels of the tiles.
+
+struct canvas {
+    uint32_t *data;
+    int width;
+    int height;
+    int stride;         // in pixels
+
+    uint32_t *row(const int y) const { return data + size_t(y)*stride; }
+};
+
+static uint32_t premultiply(const double r, const double g, const double b, const double a) {
+    return (uint32_t(a*255)<<24) | (uint32_t(r*a*255)<<16) | (uint32_t(g*a*255)<<8) | uint32_t(b*a*255);
+}
+
+// x*y/255, rounded
+static inline uint32_t mul255(const uint32_t x, const uint32_t y) {
+    const uint32_t t = x*y+128;
+    return (t+(t>>8))>>8;
+}
+
+// every channel of a premultiplied pixel times m/255
+static inline uint32_t scale_pixel(const uint32_t p, const uint32_t m) {
+    return (mul255(p>>24, m)<<24) | (mul255((p>>16)&0xff, m)<<16) | (mul255((p>>8)&0xff, m)<<8) | mul255(p&0xff, m);
+}
+
+static inline uint32_t over(const uint32_t src, const uint32_t dst) {
+    return src + scale_pixel(dst, 255-(src>>24));
+}
+
+static void fill_scalar(uint32_t *dst, const uint32_t color, const size_t n) {
+    std::fill(dst, dst+n, color);
+}
+
+static void blend_scalar(uint32_t *dst, const uint32_t *src, const size_t n) {
+    for(size_t i = 0; i<n; i++) {
+        dst[i] = over(src[i], dst[i]);
+    }
+}
+
+static void blend_mask_scalar(uint32_t *dst, const uint32_t color, const uint8_t *mask, const size_t n) {
+    for(size_t i = 0; i<n; i++) {
+        if(mask[i]) { dst[i] = over(scale_pixel(color, mask[i]), dst[i]); }
+    }
+}
+
+#ifdef SW_RENDER_X86
+// The vector kernels work on 16 bit channels, two pixels per 128 bit lane:
+// dst = src + dst*(255-src.a)/255
+
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(const __m128i x) {
+    const __m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i over_sse2(const __m128i s, const __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+    const __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+    // alpha is channel 3 of every pixel
+    const __m128i ia_lo = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xff), 0xff));
+    const __m128i ia_hi = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xff), 0xff));
+    const __m128i d_lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia_lo));
+    const __m128i d_hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia_hi));
+    return _mm_packus_epi16(_mm_add_epi16(s_lo, d_lo), _mm_add_epi16(s_hi, d_hi));
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, const uint32_t color, const size_t n) {
+    const __m128i c = _mm_set1_epi32(color);
+    size_t i = 0;
+    for(; i+4<=n; i+=4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), c);
+    }
+    fill_scalar(dst+i, color, n-i);
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(uint32_t *dst, const uint32_t *src, const size_t n) {
+    size_t i = 0;
+    for(; i+4<=n; i+=4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), over_sse2(s, d));
+    }
+    blend_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void blend_mask_sse2(uint32_t *dst, const uint32_t color, const uint8_t *mask, const size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+    size_t i = 0;
+    for(; i+4<=n; i+=4) {
+        int32_t m4;
+        memcpy(&m4, mask+i, sizeof(m4));
+        if(!m4) { continue; }
+        // spread the 4 coverage bytes to the 4 channels of their pixel
+        const __m128i m16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m4), zero);
+        const __m128i m = _mm_unpacklo_epi16(m16, m16);
+        const __m128i m_lo = _mm_unpacklo_epi32(m, m);
+        const __m128i m_hi = _mm_unpackhi_epi32(m, m);
+        const __m128i s = _mm_packus_epi16(div255_sse2(_mm_mullo_epi16(c, m_lo)), div255_sse2(_mm_mullo_epi16(c, m_hi)));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), over_sse2(s, d));
+    }
+    blend_mask_scalar(dst+i, color, mask+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(const __m256i x) {
+    const __m256i t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i over_avx2(const __m256i s, const __m256i d) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    const __m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+    const __m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+    const __m256i ia_lo = _mm256_sub_epi16(full, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, 0xff), 0xff));
+    const __m256i ia_hi = _mm256_sub_epi16(full, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, 0xff), 0xff));
+    const __m256i d_lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia_lo));
+    const __m256i d_hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia_hi));
+    // unpack and pack both stay within the 128 bit lanes, the pixel order is kept
+    return _mm256_packus_epi16(_mm256_add_epi16(s_lo, d_lo), _mm256_add_epi16(s_hi, d_hi));
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, const uint32_t color, const size_t n) {
+    const __m256i c = _mm256_set1_epi32(color);
+    size_t i = 0;
+    for(; i+8<=n; i+=8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+i), c);
+    }
+    fill_scalar(dst+i, color, n-i);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dst, const uint32_t *src, const size_t n) {
+    size_t i = 0;
+    for(; i+8<=n; i+=8) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src+i));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst+i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+i), over_avx2(s, d));
+    }
+    blend_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void blend_mask_avx2(uint32_t *dst, const uint32_t color, const uint8_t *mask, const size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c = _mm256_unpacklo_epi8(_mm256_set1_epi32(color), zero);
+    size_t i = 0;
+    for(; i+8<=n; i+=8) {
+        uint64_t m8;
+        memcpy(&m8, mask+i, sizeof(m8));
+        if(!m8) { continue; }
+        // one coverage byte per pixel, copied into its 4 channels
+        const __m256i m = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask+i))), _mm256_set1_epi32(0x01010101));
+        const __m256i s = _mm256_packus_epi16(div255_avx2(_mm256_mullo_epi16(c, _mm256_unpacklo_epi8(m, zero))),
+                                              div255_avx2(_mm256_mullo_epi16(c, _mm256_unpackhi_epi8(m, zero))));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst+i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+i), over_avx2(s, d));
+    }
+    blend_mask_scalar(dst+i, color, mask+i, n-i);
+}
+#endif
+
+struct span_kernels {
+    const char *name;
+    void (*fill)(uint32_t *dst, uint32_t color, size_t n);
+    // src over dst
+    void (*blend)(uint32_t *dst, const uint32_t *src, size_t n);
+    // color with the coverage of mask over dst
+    void (*blend_mask)(uint32_t *dst, uint32_t color, const uint8_t *mask, size_t n);
+};
+
+// the widest kernels the CPU supports, detected once
+static const span_kernels &get_span_kernels() {
+    static const span_kernels kernels = []() -> span_kernels {
+#ifdef SW_RENDER_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            return {"avx2", fill_avx2, blend_avx2, blend_mask_avx2};
+        }
+        if(__builtin_cpu_supports("sse2")) {
+            return {"sse2", fill_sse2, blend_sse2, blend_mask_sse2};
+        }
+#endif
+        return {"scalar", fill_scalar, blend_scalar, blend_mask_scalar};
+    }();
+    return kernels;
+}
+
+// clipped to the canvas
+static void fill_rect(const canvas &c, int x, int y, int w, int h, const uint32_t color) {
+    const int x1 = std::min(x+w, c.width);
+    const int y1 = std::min(y+h, c.height);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    if(x>=x1) { return; }
+    const span_kernels &k = get_span_kernels();
+    for(; y<y1; y++) {
+        k.fill(c.row(y)+x, color, x1-x);
+    }
+}
+
+// mask pixel (0, 0) is put at (x, y), clipped to the canvas
+static void blend_mask_rect(const canvas &c, const int x, const int y, const int w, const int h, const uint32_t color,
+                            const uint8_t *mask, const int mask_stride) {
+    const int x0 = std::max(x, 0);
+    const int x1 = std::min(x+w, c.width);
+    if(x0>=x1) { return; }
+    const span_kernels &k = get_span_kernels();
+    for(int row = std::max(y, 0); row<std::min(y+h, c.height); row++) {
+        k.blend_mask(c.row(row)+x0, color, mask+size_t(row-y)*mask_stride+(x0-x), x1-x0);
+    }
+}
+
+// anti-aliased coverage of the top left quadrant of a rounded rectangle, size x size
+static const std::vector<uint8_t> &get_corner_mask(const int radius, const int scale) {
+    static std::map<std::pair<int, int>, std::vector<uint8_t>> masks;
+    const auto key = std::make_pair(radius, scale);
+    auto it = masks.find(key);
+    if(it!=masks.end()) {
+        return it->second;
+    }
+    TRACE_SCOPE("corner_mask");
+    const int size = radius*scale;
+    std::vector<uint8_t> &mask = masks[key];
+    mask.resize(size*size);
+    for(int y = 0; y<size; y++) {
+        for(int x = 0; x<size; x++) {
+            const double d = std::hypot(size-(x+0.5), size-(y+0.5));
+            mask[y*size+x] = uint8_t(std::round(255*std::min(1.0, std::max(0.0, size-d+0.5))));
+        }
+    }
+    return mask;
+}
+
+// Shadow of a rounded rectangle. The corner tiles are (shadow+radius)^2 pixels
+// and reach 'radius' pixels into the rectangle, the edges are a 1D profile.
+struct shadow_tiles {
+    int size;                           // corner tile size
+    std::vector<uint32_t> corners[4];   // top left, top right, bottom left, bottom right
+    std::vector<uint32_t> edge;         // by distance from the rectangle
+};
+
+static const double shadow_alpha = 0.35;
+
+static const shadow_tiles &get_shadow_tiles(const int shadow, const int radius, const int scale) {
+    static std::map<std::tuple<int, int, int>, shadow_tiles> cache;
+    const auto key = std::make_tuple(shadow, radius, scale);
+    auto it = cache.find(key);
+    if(it!=cache.end()) {
+        return it->second;
+    }
+    TRACE_SCOPE("shadow_tiles");
+    const int s = shadow*scale;
+    const int r = radius*scale;
+    shadow_tiles &tiles = cache[key];
+    // quadratic falloff over the shadow size
+    auto alpha = [&](const double d) -> uint32_t {
+        if(d<=0) { return uint32_t(shadow_alpha*255)<<24; }
+        if(d>=s) { return 0; }
+        const double f = 1-d/s;
+        return uint32_t(shadow_alpha*255*f*f)<<24;
+    };
+    tiles.size = s+r;
+    tiles.edge.resize(s);
+    for(int d = 0; d<s; d++) {
+        tiles.edge[d] = alpha(d+0.5);
+    }
+    for(std::vector<uint32_t> &corner : tiles.corners) {
+        corner.resize(tiles.size*tiles.size);
+    }
+    for(int y = 0; y<tiles.size; y++) {
+        for(int x = 0; x<tiles.size; x++) {
+            // the centre of the corner arc is at (size, size) of the top left tile
+            const uint32_t p = alpha(std::hypot(tiles.size-(x+0.5), tiles.size-(y+0.5))-r);
+            const int m = tiles.size-1;
+            tiles.corners[0][y*tiles.size+x] = p;
+            tiles.corners[1][y*tiles.size+(m-x)] = p;
+            tiles.corners[2][(m-y)*tiles.size+x] = p;
+            tiles.corners[3][(m-y)*tiles.size+(m-x)] = p;
+        }
+    }
+    return tiles;
+}
+
+// Drop shadow around the rounded rectangle (x, y, w, h) on a transparent canvas,
+// which needs a margin of 'shadow' around it. Inside of the rectangle only the
+// corner squares are written.
+static void draw_shadow(const canvas &c, const int x, const int y, const int w, const int h,
+                        const int shadow, const int radius, const int scale) {
+    TRACE_SCOPE("draw_shadow");
+    const shadow_tiles &tiles = get_shadow_tiles(shadow, radius, scale);
+    const span_kernels &k = get_span_kernels();
+    const int s = shadow*scale;
+    const int r = radius*scale;
+    const int n = tiles.size;
+    const int ox[4] = {x-s, x+w-r, x-s, x+w-r};
+    const int oy[4] = {y-s, y-s, y+h-r, y+h-r};
+    for(int i = 0; i<4; i++) {
+        for(int row = 0; row<n; row++) {
+            memcpy(c.row(oy[i]+row)+ox[i], &tiles.corners[i][row*n], n*sizeof(uint32_t));
+        }
+    }
+    // the edges between the corners repeat the profile
+    for(int d = 0; d<s; d++) {
+        k.fill(c.row(y-1-d)+x+r, tiles.edge[d], w-2*r);
+        k.fill(c.row(y+h+d)+x+r, tiles.edge[d], w-2*r);
+    }
+    std::vector<uint32_t> left(tiles.edge.rbegin(), tiles.edge.rend());
+    for(int row = y+r; row<y+h-r; row++) {
+        memcpy(c.row(row)+x-s, left.data(), s*sizeof(uint32_t));
+        memcpy(c.row(row)+x+w, tiles.edge.data(), s*sizeof(uint32_t));
+    }
+}
+
+// Round one corner (0: top left, 1: top right, 2: bottom left, 3: bottom right)
+// of the already drawn rectangle (x, y, w, h) and put it over its shadow.
+static void round_corner(const canvas &c, const int x, const int y, const int w, const int h, const int corner,
+                         const int shadow, const int radius, const int scale) {
+    const shadow_tiles &tiles = get_shadow_tiles(shadow, radius, scale);
+    const std::vector<uint8_t> &mask = get_corner_mask(radius, scale);
+    const span_kernels &k = get_span_kernels();
+    const int r = radius*scale;
+    const int s = shadow*scale;
+    const bool right = corner&1;
+    const bool bottom = corner&2;
+    const int cx = right ? x+w-r : x;
+    const int cy = bottom ? y+h-r : y;
+    // offset of the corner square in the shadow tile
+    const int tx = right ? 0 : s;
+    const int ty = bottom ? 0 : s;
+    std::vector<uint32_t> line(r);
+    for(int row = 0; row<r; row++) {
+        uint32_t *dst = c.row(cy+row)+cx;
+        const int my = bottom ? r-1-row : row;
+        for(int col = 0; col<r; col++) {
+            const int mx = right ? r-1-col : col;
+            dst[col] = scale_pixel(dst[col], mask[my*r+mx]);
+        }
+        memcpy(line.data(), &tiles.corners[corner][(ty+row)*tiles.size+tx], r*sizeof(uint32_t));
+        k.blend(line.data(), dst, r);
+        memcpy(dst, line.data(), r*sizeof(uint32_t));
+    }
+}
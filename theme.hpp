@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <wayland-xdg-shell-client-protocol.h>
+
+// Decoration theme and layout. The geometry of every element is a rectangle
+// that is linear in the size of the main surface. A theme is compiled once into
+// a flat table of these rectangles, so that a resize evaluates all elements in
+// one branch free loop.
+
+// one row of the layout table, e.g. x = x0 + x_w*main_w
+struct layout_row {
+    int x0, y0, w0, h0;
+    int x_w, y_h, w_w, h_h;     // 0 or 1
+};
+
+struct layout_rect {
+    int x, y, w, h;
+};
+
+// edge element relative to the main surface, for border size b and title bar height t
+constexpr layout_row edge_row(const enum xdg_toplevel_resize_edge edge, const int b, const int t) {
+    return edge==XDG_TOPLEVEL_RESIZE_EDGE_NONE ?         layout_row{0, -t, 0, t,       0, 0, 1, 0} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_TOP ?          layout_row{0, -t-b, 0, b,     0, 0, 1, 0} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM ?       layout_row{0, 0, 0, b,        0, 1, 1, 0} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_LEFT ?         layout_row{-b, -t, b, t,      0, 0, 0, 1} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT ?     layout_row{-b, -b-t, b, b,    0, 0, 0, 0} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT ?  layout_row{-b, 0, b, b,       0, 1, 0, 0} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_RIGHT ?        layout_row{0, -t, b, t,       1, 0, 0, 1} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT ?    layout_row{0, -b-t, b, b,     1, 0, 0, 0} :
+           edge==XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT ? layout_row{0, 0, b, b,        1, 1, 0, 0} :
+                                                         layout_row{0, 0, 0, 0,        0, 0, 0, 0};
+}
+
+// button relative to the title bar, x<0 is measured from its right end
+constexpr layout_row button_row(const int x, const int y, const int w, const int h) {
+    return x<0 ? layout_row{x, y, w, h, 1, 0, 0, 0} : layout_row{x, y, w, h, 0, 0, 0, 0};
+}
+
+constexpr layout_rect evaluate(const layout_row &r, const int main_w, const int main_h) {
+    return {r.x0+r.x_w*main_w, r.y0+r.y_h*main_h, r.w0+r.w_w*main_w, r.h0+r.h_h*main_h};
+}
+
+static_assert(evaluate(edge_row(XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT, 5, 15), 100, 80).x==100, "layout");
+static_assert(evaluate(edge_row(XDG_TOPLEVEL_RESIZE_EDGE_LEFT, 5, 15), 100, 80).h==95, "layout");
+
+struct theme_button {
+    int function;               // button::type
+    int x, y;                   // relative to the title bar, x<0 from its right end
+    double color[4];
+};
+
+struct theme {
+    int border_size = 5;
+    int title_size = 15;
+    int button_width = 10;
+    int button_height = 8;
+    int title_text_x = 50;      // relative to the title bar
+    double title_color[4] = {1, 0, 0, 1};
+    double border_color[4] = {1, 1, 0, 1};
+    double corner_color[4] = {0, 0, 1, 1};
+    std::vector<theme_button> buttons = {
+        {0, 5, 4, {0, 0, 0, 1}},        // close
+        {1, 20, 4, {0.5, 0.5, 0.5, 1}}, // maximise
+        {2, 35, 4, {1, 1, 1, 1}},       // minimise
+    };
+
+    const double *color(const enum xdg_toplevel_resize_edge edge) const {
+        switch(edge) {
+        case XDG_TOPLEVEL_RESIZE_EDGE_NONE:
+            return title_color;
+        case XDG_TOPLEVEL_RESIZE_EDGE_TOP_LEFT:
+        case XDG_TOPLEVEL_RESIZE_EDGE_TOP_RIGHT:
+        case XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_LEFT:
+        case XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT:
+            return corner_color;
+        default:
+            return border_color;
+        }
+    }
+
+    // Reads 'key values...' lines, '#' starts a comment. Unknown keys and
+    // invalid values are reported and skipped, the previous value is kept.
+    // Sizes must be at least 1. The first 'button' line replaces the default buttons:
+    //   border 5
+    //   title 15
+    //   title_text_x 50
+    //   button_size 10 8
+    //   title_color 1 0 0 1
+    //   border_color 1 1 0 1
+    //   corner_color 0 0 1 1
+    //   button close|maximise|minimise <x> <y> <r> <g> <b> <a>
+    bool load(const std::string &path) {
+        std::ifstream file(path);
+        if(!file) {
+            std::cerr << "cannot open theme " << path << std::endl;
+            return false;
+        }
+        static const char *button_names[] = {"close", "maximise", "minimise"};
+        bool default_buttons = true;
+        std::string line;
+        for(int n = 1; std::getline(file, line); n++) {
+            std::istringstream in(line.substr(0, line.find('#')));
+            std::string key;
+            if(!(in >> key)) {
+                continue;
+            }
+            bool ok = true;
+            if(key=="border") { ok = read_size(in, border_size); }
+            else if(key=="title") { ok = read_size(in, title_size); }
+            else if(key=="title_text_x") {
+                int x;
+                ok = bool(in >> x);
+                if(ok) { title_text_x = x; }
+            }
+            else if(key=="button_size") {
+                int w = 0, h = 0;
+                ok = read_size(in, w) && read_size(in, h);
+                if(ok) {
+                    button_width = w;
+                    button_height = h;
+                }
+            }
+            else if(key=="title_color") { ok = read_color(in, title_color); }
+            else if(key=="border_color") { ok = read_color(in, border_color); }
+            else if(key=="corner_color") { ok = read_color(in, corner_color); }
+            else if(key=="button") {
+                std::string name;
+                theme_button b = {-1, 0, 0, {}};
+                ok = bool(in >> name >> b.x >> b.y) && read_color(in, b.color);
+                for(int i = 0; i<3; i++) {
+                    if(name==button_names[i]) { b.function = i; }
+                }
+                ok = ok && b.function>=0;
+                if(ok) {
+                    if(default_buttons) { buttons.clear(); }
+                    default_buttons = false;
+                    buttons.push_back(b);
+                }
+            }
+            else {
+                std::cerr << path << ":" << n << ": unknown key " << key << std::endl;
+                continue;
+            }
+            if(!ok) {
+                std::cerr << path << ":" << n << ": invalid value for " << key << std::endl;
+            }
+        }
+        return true;
+    }
+
+    // sizes of at least 1, a viewport must not have an empty destination
+    static bool read_size(std::istream &in, int &size) {
+        int value;
+        if(!(in >> value) || value<1) {
+            return false;
+        }
+        size = value;
+        return true;
+    }
+
+    static bool read_color(std::istream &in, double c[4]) {
+        double value[4];
+        if(!(in >> value[0] >> value[1] >> value[2] >> value[3])) {
+            return false;
+        }
+        std::copy(value, value+4, c);
+        return true;
+    }
+};
+
+// The layout of a theme: one row per resize edge, indexed by the edge, then
+// one row per button. Compiled once, evaluated on every resize.
+struct layout_table {
+    static const int first_button = XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT+1;
+    std::vector<layout_row> rows;
+
+    void compile(const theme &t) {
+        rows.clear();
+        for(int edge = 0; edge<first_button; edge++) {
+            rows.push_back(edge_row(xdg_toplevel_resize_edge(edge), t.border_size, t.title_size));
+        }
+        for(const theme_button &b : t.buttons) {
+            rows.push_back(button_row(b.x, b.y, t.button_width, t.button_height));
+        }
+    }
+
+    // all rectangles for a main surface size
+    void evaluate(const int main_w, const int main_h, std::vector<layout_rect> &rects) const {
+        rects.resize(rows.size());
+        for(size_t i = 0; i<rows.size(); i++) {
+            rects[i] = ::evaluate(rows[i], main_w, main_h);
+        }
+    }
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <EGL/egl.h>
+#include <GL/gl.h>
+
+#include "sw_render.hpp"
+#include "trace.hpp"
+
+// Title text drawn from a glyph atlas. The embedded bitmap font is rasterized
+// once per scale, uploaded once per context, and the glyph quads of a title are
+// only laid out again when the text changes.
+
+static const int glyph_width = 5;
+static const int glyph_height = 7;
+static const int glyph_advance = glyph_width+1;
+static const char glyph_first = ' ';
+static const char glyph_last = '~';
+
+// 5x7 font for ASCII 32..126, one byte per column, bit 0 is the top row
+static const uint8_t font_5x7[glyph_last-glyph_first+1][glyph_width] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7F,0x14,0x7F,0x14},
+    {0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00},
+    {0x00,0x1C,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1C,0x00}, {0x14,0x08,0x3E,0x08,0x14}, {0x08,0x08,0x3E,0x08,0x08},
+    {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02},
+    {0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4B,0x31},
+    {0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03},
+    {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1E}, {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00},
+    {0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06},
+    {0x32,0x49,0x79,0x41,0x3E}, {0x7E,0x11,0x11,0x11,0x7E}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22},
+    {0x7F,0x41,0x41,0x22,0x1C}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x09,0x01}, {0x3E,0x41,0x49,0x49,0x7A},
+    {0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41},
+    {0x7F,0x40,0x40,0x40,0x40}, {0x7F,0x02,0x0C,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E},
+    {0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31},
+    {0x01,0x01,0x7F,0x01,0x01}, {0x3F,0x40,0x40,0x40,0x3F}, {0x1F,0x20,0x40,0x20,0x1F}, {0x3F,0x40,0x38,0x40,0x3F},
+    {0x63,0x14,0x08,0x14,0x63}, {0x07,0x08,0x70,0x08,0x07}, {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7F,0x41,0x41,0x00},
+    {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7F,0x00}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+    {0x00,0x01,0x02,0x04,0x00}, {0x20,0x54,0x54,0x54,0x78}, {0x7F,0x48,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x20},
+    {0x38,0x44,0x44,0x48,0x7F}, {0x38,0x54,0x54,0x54,0x18}, {0x08,0x7E,0x09,0x01,0x02}, {0x0C,0x52,0x52,0x52,0x3E},
+    {0x7F,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7D,0x40,0x00}, {0x20,0x40,0x44,0x3D,0x00}, {0x7F,0x10,0x28,0x44,0x00},
+    {0x00,0x41,0x7F,0x40,0x00}, {0x7C,0x04,0x18,0x04,0x78}, {0x7C,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+    {0x7C,0x14,0x14,0x14,0x08}, {0x08,0x14,0x14,0x18,0x7C}, {0x7C,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x20},
+    {0x04,0x3F,0x44,0x40,0x20}, {0x3C,0x40,0x40,0x20,0x7C}, {0x1C,0x20,0x40,0x20,0x1C}, {0x3C,0x40,0x30,0x40,0x3C},
+    {0x44,0x28,0x10,0x28,0x44}, {0x0C,0x50,0x50,0x50,0x3C}, {0x44,0x64,0x54,0x4C,0x44}, {0x00,0x08,0x36,0x41,0x00},
+    {0x00,0x00,0x7F,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00}, {0x08,0x04,0x08,0x10,0x08},
+};
+
+// the atlas has 16 glyphs per row, every cell has a one pixel gap at the right and bottom
+static const int atlas_columns = 16;
+static const int atlas_rows = (sizeof(font_5x7)/sizeof(font_5x7[0])+atlas_columns-1)/atlas_columns;
+
+struct glyph_atlas {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> alpha;
+};
+
+// alpha mask of all glyphs, rasterized once per scale
+static const glyph_atlas &get_glyph_atlas(const int scale) {
+    static std::map<int, glyph_atlas> atlases;
+    auto it = atlases.find(scale);
+    if(it!=atlases.end()) {
+        return it->second;
+    }
+    TRACE_SCOPE("rasterize_glyphs");
+    glyph_atlas &atlas = atlases[scale];
+    atlas.width = atlas_columns*glyph_advance*scale;
+    atlas.height = atlas_rows*(glyph_height+1)*scale;
+    atlas.alpha.assign(atlas.width*atlas.height, 0);
+    for(int c = 0; c<glyph_last-glyph_first+1; c++) {
+        const int cx = (c%atlas_columns)*glyph_advance*scale;
+        const int cy = (c/atlas_columns)*(glyph_height+1)*scale;
+        for(int x = 0; x<glyph_width*scale; x++) {
+            for(int y = 0; y<glyph_height*scale; y++) {
+                if(font_5x7[c][x/scale] & (1<<(y/scale))) {
+                    atlas.alpha[(cy+y)*atlas.width + cx+x] = 255;
+                }
+            }
+        }
+    }
+    return atlas;
+}
+
+// atlas textures by context and scale
+static std::map<std::pair<EGLContext, int>, GLuint> glyph_textures;
+
+// atlas texture of a context, uploaded once per context and scale
+static GLuint get_glyph_texture(const EGLContext context, const int scale) {
+    const auto key = std::make_pair(context, scale);
+    auto it = glyph_textures.find(key);
+    if(it!=glyph_textures.end()) {
+        return it->second;
+    }
+    TRACE_SCOPE("upload_glyphs");
+    const glyph_atlas &atlas = get_glyph_atlas(scale);
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlas.width, atlas.height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, atlas.alpha.data());
+    glyph_textures[key] = texture;
+    return texture;
+}
+
+// forget the textures of a context before it is destroyed
+static void release_glyph_textures(const EGLContext context) {
+    for(auto it = glyph_textures.begin(); it!=glyph_textures.end();) {
+        it = (it->first.first==context) ? glyph_textures.erase(it) : std::next(it);
+    }
+}
+
+// atlas cell of a character, unknown characters are shown as '?'
+static int glyph_index(const char c) {
+    return ((c<glyph_first || c>glyph_last) ? '?' : c)-glyph_first;
+}
+
+// a line of text, laid out into a display list when it changes
+struct title_text {
+    std::string text;
+    int scale = 1;
+    GLuint list = 0;
+    bool changed = false;
+
+    // returns true if the text changed
+    bool set(const std::string &_text) {
+        if(_text==text) {
+            return false;
+        }
+        text = _text;
+        changed = true;
+        return true;
+    }
+
+    // draw with the top left corner at (x, y) into the current surface of size w x h
+    void draw(const EGLContext context, const int x, const int y, const int w, const int h) {
+        if(text.empty()) {
+            return;
+        }
+        TRACE_SCOPE("draw_title");
+        glViewport(0, 0, w, h);
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glOrtho(0, w, h, 0, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        glTranslatef(x, y, 0);
+
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, get_glyph_texture(context, scale));
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glColor4f(0, 0, 0, 1);
+
+        if(!list || changed) {
+            TRACE_SCOPE("layout_title");
+            release();
+            list = glGenLists(1);
+            const glyph_atlas &atlas = get_glyph_atlas(scale);
+            const float gw = glyph_width*scale;
+            const float gh = glyph_height*scale;
+            glNewList(list, GL_COMPILE);
+            glBegin(GL_QUADS);
+            for(size_t i = 0; i<text.size(); i++) {
+                const int index = glyph_index(text[i]);
+                const float u = float((index%atlas_columns)*glyph_advance*scale)/atlas.width;
+                const float v = float((index/atlas_columns)*(glyph_height+1)*scale)/atlas.height;
+                const float du = gw/atlas.width;
+                const float dv = gh/atlas.height;
+                const float px = i*glyph_advance*scale;
+                glTexCoord2f(u, v);         glVertex2f(px, 0);
+                glTexCoord2f(u+du, v);      glVertex2f(px+gw, 0);
+                glTexCoord2f(u+du, v+dv);   glVertex2f(px+gw, gh);
+                glTexCoord2f(u, v+dv);      glVertex2f(px, gh);
+            }
+            glEnd();
+            glEndList();
+            changed = false;
+        }
+        glCallList(list);
+
+        glDisable(GL_BLEND);
+        glDisable(GL_TEXTURE_2D);
+    }
+
+    // delete the display list, a context of its share group must be current
+    void release() {
+        if(list) {
+            glDeleteLists(list, 1);
+            list = 0;
+        }
+    }
+
+    // draw on the CPU with the top left corner at (x, y), clipped to the canvas
+    void draw(const canvas &c, const int x, const int y) const {
+        if(text.empty()) {
+            return;
+        }
+        TRACE_SCOPE("draw_title");
+        const glyph_atlas &atlas = get_glyph_atlas(scale);
+        for(size_t i = 0; i<text.size(); i++) {
+            const int px = x+int(i)*glyph_advance*scale;
+            if(px>=c.width) {
+                break;
+            }
+            const int index = glyph_index(text[i]);
+            const int u = (index%atlas_columns)*glyph_advance*scale;
+            const int v = (index/atlas_columns)*(glyph_height+1)*scale;
+            blend_mask_rect(c, px, y, glyph_width*scale, glyph_height*scale, 0xff000000,
+                            &atlas.alpha[v*atlas.width+u], atlas.width);
+        }
+    }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Opt-in scoped timings. Every thread records into its own ring buffer,
+// which only this thread writes to. The rings are exported in the Chrome
+// trace event format (chrome://tracing, Perfetto). When tracing is disabled,
+// a scope costs a single relaxed load.
+
+struct trace_event {
+    const char *name;
+    const char *detail;     // optional, e.g. the decoration element
+    uint64_t start;         // ns, CLOCK_MONOTONIC
+    uint64_t duration;      // ns
+};
+
+struct trace_ring {
+    static const size_t capacity = 1<<14;  // events, older ones are overwritten
+    trace_event events[capacity];
+    std::atomic<uint64_t> head{0};
+    long tid;
+    trace_ring *next;
+};
+
+// one instance for all translation units
+extern std::atomic<bool> trace_enabled;
+extern std::atomic<trace_ring *> trace_rings;
+
+static uint64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+static trace_ring *trace_thread_ring() {
+    static thread_local trace_ring *ring = nullptr;
+    if(!ring) {
+        // rings are never freed, so that they can still be dumped after the thread exited
+        ring = new trace_ring;
+        ring->tid = syscall(SYS_gettid);
+        ring->next = trace_rings.load();
+        while(!trace_rings.compare_exchange_weak(ring->next, ring)) {}
+    }
+    return ring;
+}
+
+static void trace_record(const char *name, const char *detail, uint64_t start, uint64_t duration) {
+    trace_ring *ring = trace_thread_ring();
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->events[head % trace_ring::capacity] = {name, detail, start, duration};
+    ring->head.store(head+1, std::memory_order_release);
+}
+
+struct trace_scope {
+    const char *name;
+    const char *detail;
+    uint64_t start;
+
+    trace_scope(const char *_name, const char *_detail = nullptr)
+        : name(_name), detail(_detail),
+          start(trace_enabled.load(std::memory_order_relaxed) ? trace_now() : 0) {}
+
+    ~trace_scope() {
+        if(start) {
+            trace_record(name, detail, start, trace_now()-start);
+        }
+    }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+// write all recorded events as Chrome trace JSON
+static void trace_write_json(std::ostream &out) {
+    const long pid = getpid();
+    bool first = true;
+    // µs with ns resolution, monotonic timestamps are too large for the default precision
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\": [";
+    for(trace_ring *ring = trace_rings.load(); ring; ring = ring->next) {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        const uint64_t begin = (head>trace_ring::capacity) ? head-trace_ring::capacity : 0;
+        for(uint64_t i = begin; i<head; i++) {
+            const trace_event &e = ring->events[i % trace_ring::capacity];
+            out << (first ? "\n" : ",\n")
+                << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", "
+                << "\"ts\": " << e.start/1000.0 << ", \"dur\": " << e.duration/1000.0 << ", "
+                << "\"pid\": " << pid << ", \"tid\": " << ring->tid;
+            if(e.detail) {
+                out << ", \"args\": {\"element\": \"" << e.detail << "\"}";
+            }
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}" << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}